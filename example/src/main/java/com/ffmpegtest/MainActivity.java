@@ -3,6 +3,7 @@ package com.ffmpegtest;
 import java.io.File;
 import java.util.ArrayList;
 import java.util.List;
+import java.util.Map;
 
 import android.app.Activity;
 import android.content.Intent;
@@ -54,7 +55,45 @@ public class MainActivity extends Activity implements OnItemClickListener {
 	public native int reverseNative(String file_src, String file_dest,
 																	long positionUsStart, long positionUsEnd,
 																	int videoStreamNo,
-																	int audioStreamNo, int subtitleStreamNo);
+																	int audioStreamNo, int subtitleStreamNo,
+																	Map<String, String> options);
+
+	private native long reverseCreateNative(String file_src, String file_dest,
+			long positionUsStart, long positionUsEnd, int videoStreamNo,
+			int audioStreamNo, int subtitleStreamNo, Map<String, String> options);
+
+	private native int reverseRunNative(long handle);
+
+	private native double reverseEncodeFpsNative(long handle);
+
+	private native void reverseCancelNative(long handle);
+
+	private native void reverseDestroyNative(long handle);
+
+	// the library registers its natives on this class, every entry of its
+	// table has to be declared here for the registration to succeed
+	private native long reverseQueueCreateNative(int threads, long memoryBudget);
+
+	private native int reverseQueueSubmitNative(long queue, String file_src,
+			String file_dest, long positionUsStart, long positionUsEnd,
+			int videoStreamNo, int audioStreamNo, int subtitleStreamNo,
+			Map<String, String> options);
+
+	private native int reverseQueuePollNative(long queue, int job);
+
+	private native int reverseQueueResultNative(long queue, int job);
+
+	private native void reverseQueueCancelNative(long queue, int job);
+
+	private native void reverseQueueReleaseNative(long queue, int job);
+
+	// called from native code for the fragments of a "progressive" reverse,
+	// on the thread running the job
+	private void onReverseFragment(int index, long offset, long size,
+			long endUs, boolean isLast) {
+		Log.d("reverse", "fragment " + index + ": " + size + " bytes at "
+				+ offset + ", ends at " + endUs + "us" + (isLast ? ", last" : ""));
+	}
 
 	@Override
 	protected void onCreate(Bundle savedInstanceState) {
@@ -136,9 +175,12 @@ public class MainActivity extends Activity implements OnItemClickListener {
 					Toast.makeText(activity,
 						"Start reversing...", Toast.LENGTH_SHORT).show();
 					reversedVideoFilePath = fileDst;
-					new ReverseTask(activity).execute(fileSrc, fileDst,
+					// each job has its own native context, several may run at once
+					new ReverseTask(activity).executeOnExecutor(
+						AsyncTask.THREAD_POOL_EXECUTOR, fileSrc, fileDst,
 						Long.valueOf(0), Long.valueOf(0),
-						Integer.valueOf(1), Integer.valueOf(0), Integer.valueOf(0));
+						Integer.valueOf(1), Integer.valueOf(0), Integer.valueOf(0),
+						null);
 				} else {
 					Toast.makeText(getApplicationContext(),
 						"Native code not init!", Toast.LENGTH_SHORT).show();
@@ -172,10 +214,19 @@ public class MainActivity extends Activity implements OnItemClickListener {
 			int audioStreamNo = audioStream == null ? -1 : audioStream.intValue();
 			int subtitleStreamNo = subtitleStream == null ? -1 : subtitleStream.intValue();
 
-			int result = activity.reverseNative(file_src, file_dest, startTime, endTime,
-				videoStreamNo, audioStreamNo, subtitleStreamNo);
-
-			return result;
+			@SuppressWarnings("unchecked")
+			Map<String, String> options = (Map<String, String>) params[7];
+
+			long job = activity.reverseCreateNative(file_src, file_dest,
+				startTime, endTime, videoStreamNo, audioStreamNo, subtitleStreamNo,
+				options);
+			try {
+				int result = activity.reverseRunNative(job);
+				Log.d("reverse", "encode fps: " + activity.reverseEncodeFpsNative(job));
+				return result;
+			} finally {
+				activity.reverseDestroyNative(job);
+			}
 		}
 
 		@Override
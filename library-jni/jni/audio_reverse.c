@@ -0,0 +1,263 @@
+/*
+ * audio_reverse.c
+ *
+ * Per-segment audio decoding for reverse(): the span of a video segment is
+ * decoded from its own seek, converted and reversed in memory.
+ */
+
+#include "audio_reverse.h"
+
+#include <libavutil/audioconvert.h>
+#include <libswresample/swresample.h>
+
+#include <string.h>
+
+/* decoders need some signal before the span to settle after a seek */
+#define AUDIO_PREROLL_MS 100
+
+int audio_reverse_open(AudioReverse *audio, const char *path, int stream_index,
+                       enum AVSampleFormat sample_fmt, int64_t channel_layout) {
+  AVCodecContext *dec;
+  AVCodec *codec;
+  int64_t in_layout;
+  unsigned int i;
+  int err;
+
+  memset(audio, 0, sizeof(*audio));
+  audio->stream_index = stream_index;
+  if ((err = avformat_open_input(&audio->ctx, path, NULL, NULL)) < 0) {
+    return err;
+  }
+  if ((err = avformat_find_stream_info(audio->ctx, NULL)) < 0) {
+    return err;
+  }
+  if (stream_index < 0 || stream_index >= (int) audio->ctx->nb_streams) {
+    return AVERROR(EINVAL);
+  }
+  for (i = 0; i < audio->ctx->nb_streams; i++) {
+    if (i != (unsigned int) stream_index) {
+      audio->ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+  audio->st = audio->ctx->streams[stream_index];
+  dec = audio->st->codec;
+  codec = avcodec_find_decoder(dec->codec_id);
+  if (!codec) {
+    return AVERROR_DECODER_NOT_FOUND;
+  }
+  if ((err = avcodec_open2(dec, codec, NULL)) < 0) {
+    return err;
+  }
+  audio->frame = avcodec_alloc_frame();
+  if (!audio->frame) {
+    return AVERROR(ENOMEM);
+  }
+
+  in_layout = dec->channel_layout &&
+              av_get_channel_layout_nb_channels(dec->channel_layout) == dec->channels
+              ? dec->channel_layout
+              : av_get_default_channel_layout(dec->channels);
+  audio->sample_fmt = av_get_packed_sample_fmt(sample_fmt);
+  audio->sample_rate = dec->sample_rate;
+  audio->channels = av_get_channel_layout_nb_channels(channel_layout);
+  audio->sample_size = audio->channels *
+                       av_get_bytes_per_sample(audio->sample_fmt);
+  audio->swr = swr_alloc_set_opts(NULL,
+      channel_layout, audio->sample_fmt, audio->sample_rate,
+      in_layout, dec->sample_fmt, dec->sample_rate, 0, NULL);
+  if (!audio->swr || swr_init(audio->swr) < 0) {
+    return AVERROR(EINVAL);
+  }
+  return 0;
+}
+
+void audio_reverse_close(AudioReverse *audio) {
+  if (audio->swr) {
+    swr_free(&audio->swr);
+  }
+  if (audio->st && audio->st->codec) {
+    avcodec_close(audio->st->codec);
+  }
+  if (audio->ctx) {
+    avformat_close_input(&audio->ctx);
+  }
+  av_freep(&audio->frame);
+  audio->st = NULL;
+}
+
+static int buffer_reserve(AudioBuffer *buffer, int samples, int sample_size) {
+  uint8_t *data = av_fast_realloc(buffer->data, &buffer->capacity,
+                                  (size_t) samples * sample_size);
+  if (!data) {
+    return AVERROR(ENOMEM);
+  }
+  buffer->data = data;
+  return 0;
+}
+
+/* pads the buffer with silence up to samples */
+static int buffer_fill_silence(AudioReverse *audio, AudioBuffer *buffer,
+                               int samples) {
+  int err;
+  if (samples <= buffer->samples) {
+    return 0;
+  }
+  if ((err = buffer_reserve(buffer, samples, audio->sample_size)) < 0) {
+    return err;
+  }
+  av_samples_set_silence(&buffer->data, buffer->samples,
+                         samples - buffer->samples, audio->channels,
+                         audio->sample_fmt);
+  buffer->samples = samples;
+  return 0;
+}
+
+/* Converts the decoded frame at *pos and keeps the part inside
+ * [start, end). Gaps in the stream are filled with silence so the buffer
+ * always lines up with the span. */
+static int store_frame(AudioReverse *audio, AudioBuffer *buffer, int64_t *pos,
+                       int64_t start, int64_t end) {
+  AVFrame *frame = audio->frame;
+  AVRational sample_tb = {1, audio->sample_rate};
+  int64_t first, from, to;
+  uint8_t *out;
+  int converted, err;
+
+  if (*pos == AV_NOPTS_VALUE) {
+    /* timestamps only place the first frame, then samples are counted */
+    int64_t pts = av_frame_get_best_effort_timestamp(frame);
+    *pos = pts != AV_NOPTS_VALUE ? av_rescale_q(pts, audio->st->time_base,
+                                                sample_tb)
+                                 : start;
+  }
+  first = *pos;
+  *pos += frame->nb_samples;
+  if (first + frame->nb_samples <= start) {
+    return 0;
+  }
+  if (first > start + buffer->samples &&
+      (err = buffer_fill_silence(audio, buffer,
+                                 (int) FFMIN(first, end) - start)) < 0) {
+    return err;
+  }
+  if ((err = buffer_reserve(buffer, buffer->samples + frame->nb_samples,
+                            audio->sample_size)) < 0) {
+    return err;
+  }
+  out = buffer->data + buffer->samples * audio->sample_size;
+  converted = swr_convert(audio->swr, &out, frame->nb_samples,
+                          (const uint8_t **) frame->extended_data,
+                          frame->nb_samples);
+  if (converted < 0) {
+    return converted;
+  }
+  from = FFMAX(start + buffer->samples - first, 0);
+  to = FFMIN(end - first, converted);
+  if (to <= from) {
+    return 0;
+  }
+  if (from > 0) {
+    memmove(out, out + from * audio->sample_size,
+            (to - from) * audio->sample_size);
+  }
+  buffer->samples += to - from;
+  return 0;
+}
+
+int audio_reverse_decode(AudioReverse *audio, AudioBuffer *buffer,
+                         int64_t start_sample, int64_t end_sample) {
+  AVCodecContext *dec = audio->st->codec;
+  AVRational sample_tb = {1, audio->sample_rate};
+  int64_t preroll = av_rescale(AUDIO_PREROLL_MS, audio->sample_rate, 1000);
+  int64_t pos = AV_NOPTS_VALUE;
+  AVPacket pkt, pending;
+  int eof = 0;
+  int err = 0;
+
+  buffer->samples = 0;
+  if (end_sample <= start_sample) {
+    return 0;
+  }
+  avcodec_flush_buffers(dec);
+  if (av_seek_frame(audio->ctx, audio->stream_index,
+                    av_rescale_q(FFMAX(start_sample - preroll, 0), sample_tb,
+                                 audio->st->time_base),
+                    AVSEEK_FLAG_BACKWARD) < 0) {
+    av_log(audio->ctx, AV_LOG_WARNING, "audio: seek to sample %"PRId64" failed\n",
+           start_sample);
+  }
+
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  pending = pkt;
+  while (pos == AV_NOPTS_VALUE || pos < end_sample) {
+    int got_frame = 0;
+    int used;
+    if (!eof && pending.size <= 0) {
+      av_free_packet(&pkt);
+      if (av_read_frame(audio->ctx, &pkt) < 0) {
+        /* empty packets drain the decoder */
+        eof = 1;
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
+      } else if (pkt.stream_index != audio->stream_index) {
+        pending.size = 0;
+        continue;
+      }
+      pending = pkt;
+    }
+    used = avcodec_decode_audio4(dec, audio->frame, &got_frame, &pending);
+    if (used < 0) {
+      /* skip the broken packet */
+      pending.size = 0;
+      if (eof) {
+        break;
+      }
+      continue;
+    }
+    if (!eof) {
+      pending.data += used;
+      pending.size -= used;
+    }
+    if (got_frame) {
+      if ((err = store_frame(audio, buffer, &pos, start_sample,
+                             end_sample)) < 0) {
+        break;
+      }
+    } else if (eof) {
+      break;
+    }
+  }
+  av_free_packet(&pkt);
+  if (err >= 0) {
+    err = buffer_fill_silence(audio, buffer, (int) (end_sample - start_sample));
+  }
+  return err < 0 ? err : buffer->samples;
+}
+
+void audio_reverse_samples(AudioBuffer *buffer, int sample_size) {
+  uint8_t *a, *b;
+  if (buffer->samples < 2) {
+    return;
+  }
+  a = buffer->data;
+  b = buffer->data + (buffer->samples - 1) * sample_size;
+  while (a < b) {
+    int k;
+    for (k = 0; k < sample_size; k++) {
+      uint8_t t = a[k];
+      a[k] = b[k];
+      b[k] = t;
+    }
+    a += sample_size;
+    b -= sample_size;
+  }
+}
+
+void audio_buffer_free(AudioBuffer *buffer) {
+  av_freep(&buffer->data);
+  buffer->capacity = 0;
+  buffer->samples = 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * audio_reverse.h
+ *
+ * Decodes a span of an audio stream to packed PCM in the format of the
+ * target encoder and reverses it, one reverse segment at a time.
+ */
+
+#ifndef AUDIO_REVERSE_H_
+#define AUDIO_REVERSE_H_
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+#include <libavutil/samplefmt.h>
+
+typedef struct AudioReverse {
+  AVFormatContext *ctx;
+  AVStream *st;
+  int stream_index;
+  AVFrame *frame;
+  struct SwrContext *swr;
+  enum AVSampleFormat sample_fmt;
+  int sample_rate;
+  int channels;
+  /* bytes per sample of all channels */
+  int sample_size;
+} AudioReverse;
+
+/* PCM of one segment; the data grows to the longest segment and is reused */
+typedef struct AudioBuffer {
+  uint8_t *data;
+  unsigned int capacity;
+  int samples;
+} AudioBuffer;
+
+/* Opens its own demuxer on path with every stream but stream_index
+ * discarded, and a decoder converting to packed sample_fmt at the source
+ * sample rate. Returns a negative AVERROR on failure. */
+int audio_reverse_open(AudioReverse *audio, const char *path, int stream_index,
+                       enum AVSampleFormat sample_fmt, int64_t channel_layout);
+void audio_reverse_close(AudioReverse *audio);
+
+/* Decodes the samples [start_sample, end_sample) (counted at the source
+ * sample rate from timestamp zero) into buffer. Returns the number of
+ * samples stored or a negative AVERROR. */
+int audio_reverse_decode(AudioReverse *audio, AudioBuffer *buffer,
+                         int64_t start_sample, int64_t end_sample);
+
+/* Reverses the sample order of buffer in place, channels stay together. */
+void audio_reverse_samples(AudioBuffer *buffer, int sample_size);
+
+void audio_buffer_free(AudioBuffer *buffer);
+
+#endif /* AUDIO_REVERSE_H_ */
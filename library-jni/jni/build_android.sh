@@ -22,6 +22,14 @@ if [ "$NDK" = "" ]; then
 fi
 
 OS_ARCH=`basename $NDK/toolchains/arm-linux-androideabi-4.6/prebuilt/*`
+
+# libx264 (reverse option video_encoder=libx264) is GPL, linking it makes
+# libffmpeg.so GPL too, so it is only built with ENABLE_X264=yes
+if [ "$ENABLE_X264" = "yes" ]; then
+	X264_CONFIGURE_FLAG="--enable-gpl --enable-libx264 --enable-encoder=libx264"
+	X264_LIBS="-lx264"
+fi
+
 function build_x264
 {
 	PLATFORM=$NDK/platforms/$PLATFORM_VERSION/arch-$ARCH/
@@ -333,6 +341,7 @@ EOF
 	    --enable-memalign-hack \
 	    --enable-asm \
 	    $ADDITIONAL_CONFIGURE_FLAG \
+	    $X264_CONFIGURE_FLAG \
 	    || exit 1
 	make clean || exit 1
 	make -j4 install || exit 1
@@ -343,7 +352,7 @@ EOF
 function build_one {
 	cd ffmpeg
 	PLATFORM=$NDK/platforms/$PLATFORM_VERSION/arch-$ARCH/
-	$PREBUILT/bin/$EABIARCH-ld -rpath-link=$PLATFORM/usr/lib -L$PLATFORM/usr/lib -L$PREFIX/lib  -soname $SONAME -shared -nostdlib  -z noexecstack -Bsymbolic --whole-archive --no-undefined -o $OUT_LIBRARY -lavcodec -lavformat -lavresample -lavutil -lswresample -lass -lfreetype -lfribidi -lswscale -lvo-aacenc -lvo-amrwbenc -lc -lm -lz -ldl -llog  --dynamic-linker=/system/bin/linker -zmuldefs $PREBUILT/lib/gcc/$EABIARCH/4.6/libgcc.a || exit 1
+	$PREBUILT/bin/$EABIARCH-ld -rpath-link=$PLATFORM/usr/lib -L$PLATFORM/usr/lib -L$PREFIX/lib  -soname $SONAME -shared -nostdlib  -z noexecstack -Bsymbolic --whole-archive --no-undefined -o $OUT_LIBRARY -lavcodec -lavformat -lavresample -lavutil -lswresample -lass -lfreetype -lfribidi -lswscale -lvo-aacenc -lvo-amrwbenc $X264_LIBS -lc -lm -lz -ldl -llog  --dynamic-linker=/system/bin/linker -zmuldefs $PREBUILT/lib/gcc/$EABIARCH/4.6/libgcc.a || exit 1
 	cd ..
 }
 
@@ -360,6 +369,7 @@ PREBUILT=$NDK/toolchains/arm-linux-androideabi-4.6/prebuilt/$OS_ARCH
 PLATFORM_VERSION=android-5
 build_amr
 build_aac
+[ "$ENABLE_X264" = "yes" ] && build_x264
 build_fribidi
 build_freetype2
 build_ass
@@ -378,6 +388,7 @@ PREBUILT=$NDK/toolchains/x86-4.6/prebuilt/$OS_ARCH
 PLATFORM_VERSION=android-9
 build_amr
 build_aac
+[ "$ENABLE_X264" = "yes" ] && build_x264
 build_fribidi
 build_freetype2
 build_ass
@@ -396,6 +407,7 @@ PREBUILT=$NDK/toolchains/mipsel-linux-android-4.6/prebuilt/$OS_ARCH
 PLATFORM_VERSION=android-9
 build_amr
 build_aac
+[ "$ENABLE_X264" = "yes" ] && build_x264
 build_fribidi
 build_freetype2
 build_ass
@@ -415,6 +427,7 @@ PREBUILT=$NDK/toolchains/arm-linux-androideabi-4.6/prebuilt/$OS_ARCH
 PLATFORM_VERSION=android-5
 build_amr
 build_aac
+[ "$ENABLE_X264" = "yes" ] && build_x264
 build_fribidi
 build_freetype2
 build_ass
@@ -434,6 +447,7 @@ PREBUILT=$NDK/toolchains/arm-linux-androideabi-4.6/prebuilt/$OS_ARCH
 PLATFORM_VERSION=android-9
 build_amr
 build_aac
+[ "$ENABLE_X264" = "yes" ] && build_x264
 build_fribidi
 build_freetype2
 build_ass
@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# build_host.sh
+#
+# Builds the vendored ffmpeg (and x264 with ENABLE_X264=yes) for the host
+# into ffmpeg-build/host, then reverse-cli with Makefile.host, so the
+# reverse engine can be profiled and benchmarked on a Linux box.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+JNI_DIR=$(pwd)
+PREFIX=$JNI_DIR/ffmpeg-build/host
+BUILD_DIR=$JNI_DIR/host-build
+JOBS=${JOBS:-$(nproc)}
+
+if [ "$ENABLE_X264" = "yes" ]; then
+	X264_CONFIGURE_FLAG="--enable-gpl --enable-libx264 --enable-encoder=libx264"
+fi
+
+function build_x264
+{
+	cd x264
+	./configure --prefix=$PREFIX --enable-static --disable-cli --disable-asm || exit 1
+
+	make clean || exit 1
+	make -j$JOBS install || exit 1
+	cd ..
+}
+
+# ffmpeg/ holds the Android config.h, which rules out an out of tree
+# build: the host one runs in a copy
+function build_ffmpeg
+{
+	mkdir -p $BUILD_DIR
+	rm -rf $BUILD_DIR/ffmpeg
+	cp -r ffmpeg $BUILD_DIR/ffmpeg || exit 1
+	cd $BUILD_DIR/ffmpeg
+	export PKG_CONFIG_PATH=$PREFIX/lib/pkgconfig/
+	./configure \
+	    --prefix=$PREFIX \
+	    --extra-cflags="-fcommon -I$PREFIX/include" \
+	    --extra-ldflags="-L$PREFIX/lib" \
+	    --disable-shared \
+	    --enable-static \
+	    --disable-asm \
+	    --disable-yasm \
+	    --disable-doc \
+	    --disable-ffmpeg \
+	    --disable-ffplay \
+	    --disable-ffprobe \
+	    --disable-ffserver \
+	    --disable-avdevice \
+	    --disable-avfilter \
+	    --enable-zlib \
+	    $X264_CONFIGURE_FLAG \
+	    $ADDITIONAL_CONFIGURE_FLAG \
+	    || exit 1
+
+	make -j$JOBS install || exit 1
+	cd $JNI_DIR
+}
+
+[ "$ENABLE_X264" = "yes" ] && build_x264
+build_ffmpeg
+make -f Makefile.host -j$JOBS FFMPEG_PREFIX=$PREFIX BUILD_DIR=$BUILD_DIR || exit 1
@@ -72,4 +72,85 @@ extern "C" {
 			               dst_argb, dst_stride_argb,
 			               width, height);
 	}
+
+	int __NV12ToI420(const uint8* src_y, int src_stride_y,
+	               const uint8* src_uv, int src_stride_uv,
+	               uint8* dst_y, int dst_stride_y,
+	               uint8* dst_u, int dst_stride_u,
+	               uint8* dst_v, int dst_stride_v,
+	               int width, int height) {
+		return libyuv::NV12ToI420(src_y, src_stride_y,
+		               src_uv, src_stride_uv,
+		               dst_y, dst_stride_y,
+		               dst_u, dst_stride_u,
+		               dst_v, dst_stride_v,
+		               width, height);
+	}
+
+	int __NV21ToI420(const uint8* src_y, int src_stride_y,
+	               const uint8* src_vu, int src_stride_vu,
+	               uint8* dst_y, int dst_stride_y,
+	               uint8* dst_u, int dst_stride_u,
+	               uint8* dst_v, int dst_stride_v,
+	               int width, int height) {
+		return libyuv::NV21ToI420(src_y, src_stride_y,
+		               src_vu, src_stride_vu,
+		               dst_y, dst_stride_y,
+		               dst_u, dst_stride_u,
+		               dst_v, dst_stride_v,
+		               width, height);
+	}
+
+	int __I422ToI420(const uint8* src_y, int src_stride_y,
+	               const uint8* src_u, int src_stride_u,
+	               const uint8* src_v, int src_stride_v,
+	               uint8* dst_y, int dst_stride_y,
+	               uint8* dst_u, int dst_stride_u,
+	               uint8* dst_v, int dst_stride_v,
+	               int width, int height) {
+		return libyuv::I422ToI420(src_y, src_stride_y,
+		               src_u, src_stride_u,
+		               src_v, src_stride_v,
+		               dst_y, dst_stride_y,
+		               dst_u, dst_stride_u,
+		               dst_v, dst_stride_v,
+		               width, height);
+	}
+
+	int __I444ToI420(const uint8* src_y, int src_stride_y,
+	               const uint8* src_u, int src_stride_u,
+	               const uint8* src_v, int src_stride_v,
+	               uint8* dst_y, int dst_stride_y,
+	               uint8* dst_u, int dst_stride_u,
+	               uint8* dst_v, int dst_stride_v,
+	               int width, int height) {
+		return libyuv::I444ToI420(src_y, src_stride_y,
+		               src_u, src_stride_u,
+		               src_v, src_stride_v,
+		               dst_y, dst_stride_y,
+		               dst_u, dst_stride_u,
+		               dst_v, dst_stride_v,
+		               width, height);
+	}
+
+	int __I420Scale(const uint8* src_y, int src_stride_y,
+	              const uint8* src_u, int src_stride_u,
+	              const uint8* src_v, int src_stride_v,
+	              int src_width, int src_height,
+	              uint8* dst_y, int dst_stride_y,
+	              uint8* dst_u, int dst_stride_u,
+	              uint8* dst_v, int dst_stride_v,
+	              int dst_width, int dst_height,
+	              enum __FilterMode filtering) {
+		libyuv::FilterMode filterMode = static_cast<libyuv::FilterMode>(filtering);
+		return libyuv::I420Scale(src_y, src_stride_y,
+		              src_u, src_stride_u,
+		              src_v, src_stride_v,
+		              src_width, src_height,
+		              dst_y, dst_stride_y,
+		              dst_u, dst_stride_u,
+		              dst_v, dst_stride_v,
+		              dst_width, dst_height,
+		              filterMode);
+	}
 }
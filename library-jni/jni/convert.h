@@ -43,6 +43,43 @@ enum __FilterMode {
 	int __ARGBToRGBA(const uint8* src_frame, int src_stride_frame,
 	               uint8* dst_argb, int dst_stride_argb,
 	               int width, int height);
+
+	int __NV12ToI420(const uint8* src_y, int src_stride_y,
+	               const uint8* src_uv, int src_stride_uv,
+	               uint8* dst_y, int dst_stride_y,
+	               uint8* dst_u, int dst_stride_u,
+	               uint8* dst_v, int dst_stride_v,
+	               int width, int height);
+	int __NV21ToI420(const uint8* src_y, int src_stride_y,
+	               const uint8* src_vu, int src_stride_vu,
+	               uint8* dst_y, int dst_stride_y,
+	               uint8* dst_u, int dst_stride_u,
+	               uint8* dst_v, int dst_stride_v,
+	               int width, int height);
+	int __I422ToI420(const uint8* src_y, int src_stride_y,
+	               const uint8* src_u, int src_stride_u,
+	               const uint8* src_v, int src_stride_v,
+	               uint8* dst_y, int dst_stride_y,
+	               uint8* dst_u, int dst_stride_u,
+	               uint8* dst_v, int dst_stride_v,
+	               int width, int height);
+	int __I444ToI420(const uint8* src_y, int src_stride_y,
+	               const uint8* src_u, int src_stride_u,
+	               const uint8* src_v, int src_stride_v,
+	               uint8* dst_y, int dst_stride_y,
+	               uint8* dst_u, int dst_stride_u,
+	               uint8* dst_v, int dst_stride_v,
+	               int width, int height);
+
+	int __I420Scale(const uint8* src_y, int src_stride_y,
+	              const uint8* src_u, int src_stride_u,
+	              const uint8* src_v, int src_stride_v,
+	              int src_width, int src_height,
+	              uint8* dst_y, int dst_stride_y,
+	              uint8* dst_u, int dst_stride_u,
+	              uint8* dst_v, int dst_stride_v,
+	              int dst_width, int dst_height,
+	              enum __FilterMode filtering);
 #ifdef __cplusplus
 }
 #endif
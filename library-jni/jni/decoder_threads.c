@@ -0,0 +1,64 @@
+/*
+ * decoder_threads.c
+ *
+ * Decoder threading policy, see decoder_threads.h.
+ */
+
+#include "decoder_threads.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/common.h>
+
+/* libavcodec's own limit, MAX_AUTO_THREADS in pthread.c */
+#define DECODER_THREADS_MAX 16
+
+void decoder_threads_read(DecoderThreads *threads, AVDictionary *options) {
+  AVDictionaryEntry *entry;
+  if ((entry = av_dict_get(options, "decoder_threads", NULL, 0))) {
+    threads->count = strcmp(entry->value, "auto") ? atoi(entry->value) : 0;
+  }
+  if ((entry = av_dict_get(options, "decoder_thread_type", NULL, 0))) {
+    if (!strcmp(entry->value, "frame")) {
+      threads->mode = DECODER_THREADS_FRAME;
+    } else if (!strcmp(entry->value, "slice")) {
+      threads->mode = DECODER_THREADS_SLICE;
+    } else if (!strcmp(entry->value, "low_delay")) {
+      threads->mode = DECODER_THREADS_LOW_DELAY;
+    } else {
+      threads->mode = DECODER_THREADS_AUTO;
+    }
+  }
+}
+
+void decoder_threads_apply(const DecoderThreads *threads, AVCodecContext *c,
+                           int decoders) {
+  int count = threads->count;
+  if (count <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    count = FFMIN((int) FFMAX(cores, 1) / FFMAX(decoders, 1),
+                  DECODER_THREADS_MAX);
+  }
+  c->thread_count = FFMAX(count, 1);
+  switch (threads->mode) {
+  case DECODER_THREADS_FRAME:
+    c->thread_type = FF_THREAD_FRAME;
+    break;
+  case DECODER_THREADS_SLICE:
+  case DECODER_THREADS_LOW_DELAY:
+    c->thread_type = FF_THREAD_SLICE;
+    break;
+  default:
+    c->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    break;
+  }
+}
+
+int decoder_threads_delay(const AVCodecContext *c) {
+  /* active_thread_type is only known once the codec is open */
+  if (c->active_thread_type & FF_THREAD_FRAME) {
+    return c->thread_count - 1;
+  }
+  return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * decoder_threads.h
+ *
+ * Threading policy of the video decoders, shared by the player and the
+ * reverse engine: how many threads and whether libavcodec splits the work
+ * by frame, by slice or both.
+ */
+
+#ifndef DECODER_THREADS_H_
+#define DECODER_THREADS_H_
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+
+typedef enum DecoderThreadMode {
+  /* frame and slice threading, whichever the codec supports */
+  DECODER_THREADS_AUTO = 0,
+  /* frame threading: scales best, but holds back one frame per thread */
+  DECODER_THREADS_FRAME,
+  /* slice threading only: no extra delay, scales with the slice count */
+  DECODER_THREADS_SLICE,
+  /* as slice, the mode for playback where a frame held back is latency */
+  DECODER_THREADS_LOW_DELAY
+} DecoderThreadMode;
+
+typedef struct DecoderThreads {
+  /* threads per decoder, 0 for the core count shared by the decoders */
+  int count;
+  DecoderThreadMode mode;
+} DecoderThreads;
+
+/* Reads "decoder_threads" (a count, 0 or "auto") and "decoder_thread_type"
+ * ("auto", "frame", "slice" or "low_delay") from options, which may be
+ * NULL; what is not there keeps the value threads already has. */
+void decoder_threads_read(DecoderThreads *threads, AVDictionary *options);
+
+/* Sets thread_count and thread_type of a decoder before avcodec_open2().
+ * decoders is how many decoders run at the same time and share the cores
+ * when the count is automatic. */
+void decoder_threads_apply(const DecoderThreads *threads, AVCodecContext *c,
+                           int decoders);
+
+/* Frames the opened decoder may hold back beyond the codec's own delay:
+ * with frame threading every thread but one. */
+int decoder_threads_delay(const AVCodecContext *c);
+
+#endif /* DECODER_THREADS_H_ */
@@ -0,0 +1,217 @@
+/*
+ * frame_cache.c
+ *
+ * XOR delta chain of decoded pictures for the reverse buffer list.
+ */
+
+#include "frame_cache.h"
+
+#include <string.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+/* unchanged runs shorter than this many words stay in the literal run */
+#define FRAME_CACHE_MIN_SKIP 4
+
+/* A packed delta is a list of records: a header of two 32 bit word counts,
+ * unchanged words to skip and changed words that follow, then the changed
+ * words XORed with the reference. */
+typedef struct FrameCacheRecord {
+  uint32_t skip;
+  uint32_t literal;
+} FrameCacheRecord;
+
+/* every record but the last is followed by at least FRAME_CACHE_MIN_SKIP
+ * unchanged words */
+static size_t packed_bound(size_t frameSize) {
+  size_t words = frameSize / 8;
+  return frameSize +
+         (words / (FRAME_CACHE_MIN_SKIP + 1) + 2) * sizeof(FrameCacheRecord);
+}
+
+static size_t pack_delta(uint8_t *out, const uint8_t *cur, const uint8_t *ref,
+                         size_t frameSize) {
+  const uint64_t *c = (const uint64_t *) cur;
+  const uint64_t *r = (const uint64_t *) ref;
+  size_t n = frameSize / 8;
+  size_t i = 0;
+  uint8_t *p = out;
+  while (i < n) {
+    FrameCacheRecord record;
+    size_t start = i, literal, zeros = 0;
+    uint64_t *words;
+    while (i < n && c[i] == r[i]) {
+      i++;
+    }
+    if (i == n) {
+      break;
+    }
+    record.skip = (uint32_t) (i - start);
+    literal = i;
+    while (i < n) {
+      if (c[i] != r[i]) {
+        zeros = 0;
+      } else if (++zeros == FRAME_CACHE_MIN_SKIP) {
+        break;
+      }
+      i++;
+    }
+    if (i < n) {
+      /* hand the unchanged run to the next record */
+      i -= FRAME_CACHE_MIN_SKIP - 1;
+      zeros = 0;
+    }
+    record.literal = (uint32_t) (i - zeros - literal);
+    memcpy(p, &record, sizeof(record));
+    p += sizeof(record);
+    words = (uint64_t *) p;
+    for (start = 0; start < record.literal; start++) {
+      words[start] = c[literal + start] ^ r[literal + start];
+    }
+    p += record.literal * 8;
+  }
+  return p - out;
+}
+
+static void apply_delta(uint8_t *ref, const uint8_t *packed, size_t size) {
+  uint64_t *r = (uint64_t *) ref;
+  const uint8_t *p = packed;
+  const uint8_t *end = packed + size;
+  while (p < end) {
+    FrameCacheRecord record;
+    const uint64_t *words;
+    uint32_t k;
+    memcpy(&record, p, sizeof(record));
+    p += sizeof(record);
+    r += record.skip;
+    words = (const uint64_t *) p;
+    for (k = 0; k < record.literal; k++) {
+      r[k] ^= words[k];
+    }
+    r += record.literal;
+    p += record.literal * 8;
+  }
+}
+
+int frame_cache_init(FrameCache *cache, size_t arenaSize, size_t frameSize,
+                     int maxEntries) {
+  memset(cache, 0, sizeof(*cache));
+  if (maxEntries <= 0 || frameSize % 8) {
+    return AVERROR(EINVAL);
+  }
+  cache->arena = av_malloc(FFMAX(arenaSize, 8));
+  cache->entries = av_malloc(maxEntries * sizeof(*cache->entries));
+  cache->packed = av_malloc(packed_bound(frameSize));
+  if (!cache->arena || !cache->entries || !cache->packed) {
+    frame_cache_free(cache);
+    return AVERROR(ENOMEM);
+  }
+  cache->arenaSize = arenaSize;
+  cache->maxEntries = maxEntries;
+  cache->frameSize = frameSize;
+  frame_cache_reset(cache);
+  return 0;
+}
+
+void frame_cache_free(FrameCache *cache) {
+  av_freep(&cache->arena);
+  av_freep(&cache->entries);
+  av_freep(&cache->packed);
+  cache->count = 0;
+}
+
+void frame_cache_reset(FrameCache *cache) {
+  cache->first = 0;
+  cache->count = 0;
+  cache->used = 0;
+  cache->basePos = -1;
+  cache->evicted = 0;
+}
+
+static FrameCacheEntry *entry_at(FrameCache *cache, int i) {
+  return &cache->entries[(cache->first + i) % cache->maxEntries];
+}
+
+static void drop_oldest(FrameCache *cache) {
+  FrameCacheEntry *oldest = entry_at(cache, 0);
+  cache->basePos = oldest->pos;
+  cache->used -= oldest->size;
+  cache->first = (cache->first + 1) % cache->maxEntries;
+  cache->count--;
+  cache->evicted++;
+}
+
+/* Finds room for size bytes after the newest delta, wrapping to the start
+ * of the arena when the end is too short. Returns 0 when the arena cannot
+ * hold it even empty. */
+static int reserve(FrameCache *cache, size_t size, size_t *offset) {
+  while (1) {
+    size_t head, tail;
+    if (cache->count == 0) {
+      *offset = 0;
+      return size <= cache->arenaSize;
+    }
+    if (cache->count < cache->maxEntries) {
+      FrameCacheEntry *newest = entry_at(cache, cache->count - 1);
+      head = entry_at(cache, 0)->offset;
+      tail = newest->offset + newest->size;
+      /* equal offsets mean a full ring, unless every delta is empty */
+      if (tail > head || cache->used == 0) {
+        if (cache->arenaSize - tail >= size) {
+          *offset = tail;
+          return 1;
+        }
+        if (head >= size) {
+          *offset = 0;
+          return 1;
+        }
+      } else if (head - tail >= size) {
+        *offset = tail;
+        return 1;
+      }
+    }
+    drop_oldest(cache);
+  }
+}
+
+int frame_cache_append(FrameCache *cache, const uint8_t *cur,
+                       const uint8_t *ref, int pos) {
+  FrameCacheEntry *entry;
+  size_t size, offset;
+  if (cache->basePos < 0) {
+    cache->basePos = pos;
+    return 0;
+  }
+  size = pack_delta(cache->packed, cur, ref, cache->frameSize);
+  if (!reserve(cache, size, &offset)) {
+    /* not even one delta fits: only the newest picture is left */
+    cache->basePos = pos;
+    cache->evicted++;
+    return 0;
+  }
+  memcpy(cache->arena + offset, cache->packed, size);
+  entry = entry_at(cache, cache->count++);
+  entry->offset = offset;
+  entry->size = size;
+  entry->pos = pos;
+  cache->used += size;
+  return 0;
+}
+
+int frame_cache_step_back(FrameCache *cache, uint8_t *ref) {
+  FrameCacheEntry *newest;
+  if (cache->count == 0) {
+    return -1;
+  }
+  newest = entry_at(cache, cache->count - 1);
+  apply_delta(ref, cache->arena + newest->offset, newest->size);
+  cache->used -= newest->size;
+  cache->count--;
+  return cache->count > 0 ? entry_at(cache, cache->count - 1)->pos
+                          : cache->basePos;
+}
+
+size_t frame_cache_used(const FrameCache *cache) {
+  return cache->used;
+}
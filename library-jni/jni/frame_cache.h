@@ -0,0 +1,64 @@
+/*
+ * frame_cache.h
+ *
+ * Compressed store for the decoded pictures of one reverse segment. Only
+ * the newest picture is kept whole (in a frame pool slot owned by the
+ * caller); every older one is the XOR of itself and its successor, with
+ * the unchanged runs left out. Walking back from the newest picture
+ * restores the older ones in exactly the order reverse() encodes them.
+ * Mostly static content (screen recordings, slides) takes a small
+ * fraction of its raw size.
+ */
+
+#ifndef FRAME_CACHE_H_
+#define FRAME_CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct FrameCacheEntry {
+  size_t offset;
+  size_t size;
+  /* display position of the picture this delta leads to */
+  int pos;
+} FrameCacheEntry;
+
+typedef struct FrameCache {
+  /* byte ring holding the packed deltas, oldest first */
+  uint8_t *arena;
+  size_t arenaSize;
+  FrameCacheEntry *entries;
+  int maxEntries;
+  int first;
+  int count;
+  size_t used;
+  /* one packed delta before it goes in the arena */
+  uint8_t *packed;
+  /* picture size, a multiple of 8 bytes */
+  size_t frameSize;
+  /* oldest picture that can still be restored, -1 when empty */
+  int basePos;
+  /* deltas dropped since the last frame_cache_reset() */
+  int evicted;
+} FrameCache;
+
+int frame_cache_init(FrameCache *cache, size_t arenaSize, size_t frameSize,
+                     int maxEntries);
+void frame_cache_free(FrameCache *cache);
+void frame_cache_reset(FrameCache *cache);
+
+/* Records picture pos, whose bytes are cur, after the picture in ref (the
+ * first call after a reset only sets the base). When the arena is full the
+ * oldest deltas are dropped and basePos moves forward: the pictures before
+ * it have to be decoded again. Returns 0 or a negative AVERROR. */
+int frame_cache_append(FrameCache *cache, const uint8_t *cur,
+                       const uint8_t *ref, int pos);
+
+/* Turns ref from the newest picture left into the one before it. Returns
+ * that picture's position, or -1 when ref already holds basePos. */
+int frame_cache_step_back(FrameCache *cache, uint8_t *ref);
+
+/* bytes the deltas take right now */
+size_t frame_cache_used(const FrameCache *cache);
+
+#endif /* FRAME_CACHE_H_ */
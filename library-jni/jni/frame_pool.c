@@ -0,0 +1,306 @@
+/*
+ * frame_pool.c
+ *
+ * Slab-backed picture slots for the reverse buffer list, and the copy of
+ * decoded pictures into them.
+ */
+
+#include "frame_pool.h"
+#include "convert.h"
+
+#include <string.h>
+#include <libavutil/common.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+
+#define FRAME_POOL_ALIGN 32
+
+#define FRAME_POOL_STORED 1
+#define FRAME_POOL_DECODER 2
+
+static int frame_pool_layout(FramePool *pool, int width, int height,
+                             const int *linesize, int paddedHeight,
+                             enum PixelFormat pix_fmt) {
+  uint8_t *data[4];
+  int size, i;
+
+  if (linesize) {
+    memcpy(pool->linesize, linesize, sizeof(pool->linesize));
+  } else {
+    if (av_image_fill_linesizes(pool->linesize, pix_fmt, width) < 0) {
+      return -1;
+    }
+    for (i = 0; i < 4; i++) {
+      pool->linesize[i] = FFALIGN(pool->linesize[i], FRAME_POOL_ALIGN);
+    }
+  }
+  /* plane offsets relative to a NULL base give the slot layout */
+  size = av_image_fill_pointers(data, pix_fmt, FFMAX(height, paddedHeight),
+                                NULL, pool->linesize);
+  if (size < 0) {
+    return -1;
+  }
+  for (i = 0; i < 4; i++) {
+    pool->planeOffset[i] = data[i] ? (size_t) (data[i] - (uint8_t *) NULL) : 0;
+  }
+  pool->slotSize = FFALIGN((size_t) size, FRAME_POOL_ALIGN);
+  pool->width = width;
+  pool->height = height;
+  pool->pix_fmt = pix_fmt;
+  return 0;
+}
+
+size_t frame_pool_slot_size(int width, int height, enum PixelFormat pix_fmt) {
+  FramePool pool;
+  memset(&pool, 0, sizeof(pool));
+  if (frame_pool_layout(&pool, width, height, NULL, height, pix_fmt) < 0) {
+    return 0;
+  }
+  return pool.slotSize;
+}
+
+static int frame_pool_alloc(FramePool *pool, int capacity) {
+  if (pool->slotSize > (SIZE_MAX - FRAME_POOL_ALIGN) / capacity) {
+    return -1;
+  }
+  /* decoders may read a little past the last plane of the last slot */
+  pool->slab = av_malloc(pool->slotSize * capacity + FRAME_POOL_ALIGN);
+  pool->holders = av_mallocz(capacity);
+  if (!pool->slab || !pool->holders) {
+    frame_pool_free(pool);
+    return -1;
+  }
+  pool->capacity = capacity;
+  return 0;
+}
+
+int frame_pool_init(FramePool *pool, int capacity, int width, int height,
+                    enum PixelFormat pix_fmt) {
+  memset(pool, 0, sizeof(*pool));
+  if (capacity <= 0 ||
+      frame_pool_layout(pool, width, height, NULL, height, pix_fmt) < 0) {
+    return -1;
+  }
+  return frame_pool_alloc(pool, capacity);
+}
+
+int frame_pool_init_layout(FramePool *pool, int capacity, int width,
+                           int height, const int linesize[4],
+                           int paddedHeight, enum PixelFormat pix_fmt) {
+  memset(pool, 0, sizeof(*pool));
+  if (capacity <= 0 || frame_pool_layout(pool, width, height, linesize,
+                                         paddedHeight, pix_fmt) < 0) {
+    return -1;
+  }
+  return frame_pool_alloc(pool, capacity);
+}
+
+void frame_pool_free(FramePool *pool) {
+  av_freep(&pool->slab);
+  av_freep(&pool->holders);
+  pool->capacity = 0;
+  pool->count = 0;
+  pool->rendered = 0;
+}
+
+static int frame_pool_find_free(const FramePool *pool) {
+  int slot;
+  for (slot = 0; slot < pool->capacity; slot++) {
+    if (!pool->holders[slot]) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+int frame_pool_acquire(FramePool *pool) {
+  int slot = frame_pool_find_free(pool);
+  if (slot >= 0) {
+    pool->holders[slot] = FRAME_POOL_STORED;
+    pool->count++;
+  }
+  return slot;
+}
+
+int frame_pool_render(FramePool *pool, int limit) {
+  int slot;
+  if (pool->rendered >= limit || (slot = frame_pool_find_free(pool)) < 0) {
+    return -1;
+  }
+  pool->holders[slot] = FRAME_POOL_DECODER;
+  pool->rendered++;
+  return slot;
+}
+
+int frame_pool_keep(FramePool *pool, int slot) {
+  if (pool->holders[slot] & FRAME_POOL_STORED) {
+    return -1;
+  }
+  if (pool->holders[slot] & FRAME_POOL_DECODER) {
+    pool->rendered--;
+  }
+  pool->holders[slot] |= FRAME_POOL_STORED;
+  pool->count++;
+  return 0;
+}
+
+void frame_pool_release(FramePool *pool, int slot) {
+  if (pool->holders[slot] == FRAME_POOL_DECODER) {
+    pool->rendered--;
+  }
+  pool->holders[slot] &= ~FRAME_POOL_DECODER;
+}
+
+int frame_pool_slot_at(const FramePool *pool, const uint8_t *data) {
+  if (!pool->slab || data < pool->slab ||
+      data >= pool->slab + pool->slotSize * pool->capacity) {
+    return -1;
+  }
+  return (int) ((size_t) (data - pool->slab) / pool->slotSize);
+}
+
+void frame_pool_reset(FramePool *pool) {
+  int slot;
+  for (slot = 0; slot < pool->capacity; slot++) {
+    if (pool->holders[slot] & FRAME_POOL_STORED) {
+      pool->holders[slot] &= ~FRAME_POOL_STORED;
+      if (pool->holders[slot]) {
+        pool->rendered++;
+      }
+    }
+  }
+  pool->count = 0;
+}
+
+void frame_pool_planes_at(const FramePool *pool, uint8_t *base,
+                          uint8_t *data[4]) {
+  int i;
+  for (i = 0; i < 4; i++) {
+    data[i] = pool->linesize[i] ? base + pool->planeOffset[i] : NULL;
+  }
+}
+
+uint8_t *frame_pool_slot(const FramePool *pool, int slot) {
+  return pool->slab + pool->slotSize * slot;
+}
+
+void frame_pool_planes(const FramePool *pool, int slot, uint8_t *data[4]) {
+  frame_pool_planes_at(pool, frame_pool_slot(pool, slot), data);
+}
+
+/* planar with one component per plane: Y, U, V and maybe alpha */
+static int frame_pool_is_planar_yuv(const AVPixFmtDescriptor *desc) {
+  int i;
+  if (!(desc->flags & PIX_FMT_PLANAR) || (desc->flags & PIX_FMT_RGB) ||
+      desc->nb_components < 3) {
+    return 0;
+  }
+  for (i = 0; i < desc->nb_components; i++) {
+    if (desc->comp[i].plane != i) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* keeps the top 8 bits of little-endian 9 to 16-bit samples */
+static void frame_pool_shift_plane(uint8_t *dst, int dstLinesize,
+                                   const uint8_t *src, int srcLinesize,
+                                   int width, int height, int shift) {
+  int x, y;
+  for (y = 0; y < height; y++) {
+    const uint8_t *in = src + (ptrdiff_t) srcLinesize * y;
+    uint8_t *out = dst + (ptrdiff_t) dstLinesize * y;
+    for (x = 0; x < width; x++) {
+      out[x] = (uint8_t) (AV_RL16(in + 2 * x) >> shift);
+    }
+  }
+}
+
+int frame_pool_store(const FramePool *pool, uint8_t *data[4],
+                     uint8_t *const src[4], const int srcLinesize[4],
+                     enum PixelFormat srcFormat, int srcWidth, int srcHeight) {
+  const AVPixFmtDescriptor *desc;
+  int width = pool->width, height = pool->height;
+  int chromaWidth = -((-width) >> 1), chromaHeight = -((-height) >> 1);
+  int depth, i;
+
+  if (srcFormat == pool->pix_fmt && srcWidth == width && srcHeight == height) {
+    int linesize[4];
+    memcpy(linesize, pool->linesize, sizeof(linesize));
+    av_image_copy(data, linesize, (const uint8_t **) src, srcLinesize,
+                  srcFormat, width, height);
+    return 0;
+  }
+  if (pool->pix_fmt != PIX_FMT_YUV420P || srcFormat <= PIX_FMT_NONE ||
+      srcFormat >= PIX_FMT_NB) {
+    return -1;
+  }
+  desc = &av_pix_fmt_descriptors[srcFormat];
+  depth = desc->comp[0].depth_minus1 + 1;
+
+  if (srcWidth != width || srcHeight != height) {
+    if (!frame_pool_is_planar_yuv(desc) || depth != 8 ||
+        desc->log2_chroma_w != 1 || desc->log2_chroma_h != 1) {
+      return -1;
+    }
+    __I420Scale(src[0], srcLinesize[0], src[1], srcLinesize[1],
+                src[2], srcLinesize[2], srcWidth, srcHeight,
+                data[0], pool->linesize[0], data[1], pool->linesize[1],
+                data[2], pool->linesize[2], width, height, __kFilterBilinear);
+    return 1;
+  }
+
+  if (srcFormat == PIX_FMT_NV12) {
+    __NV12ToI420(src[0], srcLinesize[0], src[1], srcLinesize[1],
+                 data[0], pool->linesize[0], data[1], pool->linesize[1],
+                 data[2], pool->linesize[2], width, height);
+    return 1;
+  }
+  if (srcFormat == PIX_FMT_NV21) {
+    __NV21ToI420(src[0], srcLinesize[0], src[1], srcLinesize[1],
+                 data[0], pool->linesize[0], data[1], pool->linesize[1],
+                 data[2], pool->linesize[2], width, height);
+    return 1;
+  }
+  if (!frame_pool_is_planar_yuv(desc)) {
+    return -1;
+  }
+  if (depth == 8) {
+    if (desc->log2_chroma_w == 1 && desc->log2_chroma_h == 1) {
+      /* yuvj420p, or yuva420p without its alpha */
+      for (i = 0; i < 3; i++) {
+        av_image_copy_plane(data[i], pool->linesize[i], src[i], srcLinesize[i],
+                            i ? chromaWidth : width, i ? chromaHeight : height);
+      }
+      return 0;
+    }
+    if (desc->log2_chroma_w == 1 && desc->log2_chroma_h == 0) {
+      __I422ToI420(src[0], srcLinesize[0], src[1], srcLinesize[1],
+                   src[2], srcLinesize[2],
+                   data[0], pool->linesize[0], data[1], pool->linesize[1],
+                   data[2], pool->linesize[2], width, height);
+      return 1;
+    }
+    if (desc->log2_chroma_w == 0 && desc->log2_chroma_h == 0) {
+      __I444ToI420(src[0], srcLinesize[0], src[1], srcLinesize[1],
+                   src[2], srcLinesize[2],
+                   data[0], pool->linesize[0], data[1], pool->linesize[1],
+                   data[2], pool->linesize[2], width, height);
+      return 1;
+    }
+    return -1;
+  }
+  if (depth > 8 && depth <= 16 && !(desc->flags & PIX_FMT_BE) &&
+      desc->log2_chroma_w == 1 && desc->log2_chroma_h == 1) {
+    for (i = 0; i < 3; i++) {
+      frame_pool_shift_plane(data[i], pool->linesize[i], src[i], srcLinesize[i],
+                             i ? chromaWidth : width, i ? chromaHeight : height,
+                             depth - 8);
+    }
+    return 1;
+  }
+  return -1;
+}
@@ -0,0 +1,78 @@
+/*
+ * frame_pool.h
+ *
+ * Fixed-capacity store for decoded pictures: one aligned slab carved into
+ * equal slots, sized once per job and recycled between segments. A decoder
+ * may render straight into the slots, which then stay out of use for as
+ * long as it references them.
+ */
+
+#ifndef FRAME_POOL_H_
+#define FRAME_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libavutil/pixfmt.h>
+
+typedef struct FramePool {
+  uint8_t *slab;
+  size_t slotSize;
+  int capacity;
+  /* slots stored since the last frame_pool_reset() */
+  int count;
+  /* per slot: stored, and/or rendered into or referenced by a decoder */
+  uint8_t *holders;
+  /* slots only the decoder holds */
+  int rendered;
+  int width;
+  int height;
+  enum PixelFormat pix_fmt;
+  int linesize[4];
+  size_t planeOffset[4];
+} FramePool;
+
+int frame_pool_init(FramePool *pool, int capacity, int width, int height,
+                    enum PixelFormat pix_fmt);
+/* As frame_pool_init(), with the plane strides given and room for
+ * paddedHeight lines, so a decoder can render into the slots: they must
+ * match what avcodec_default_get_buffer() would give it. */
+int frame_pool_init_layout(FramePool *pool, int capacity, int width,
+                           int height, const int linesize[4],
+                           int paddedHeight, enum PixelFormat pix_fmt);
+/* Bytes one slot takes for this picture size, 0 if it cannot be stored. */
+size_t frame_pool_slot_size(int width, int height, enum PixelFormat pix_fmt);
+void frame_pool_free(FramePool *pool);
+
+/* Stores into a free slot and returns it, or -1 when every slot is in
+ * use. */
+int frame_pool_acquire(FramePool *pool);
+/* Gives a free slot to the decoder, or -1 when none is free or the
+ * decoder alone already holds limit slots. */
+int frame_pool_render(FramePool *pool, int limit);
+/* Stores a slot the decoder rendered into; -1 if it is already stored. */
+int frame_pool_keep(FramePool *pool, int slot);
+/* The decoder is done with a slot; it is free once it is not stored. */
+void frame_pool_release(FramePool *pool, int slot);
+/* the slot holding the byte at data, -1 if none */
+int frame_pool_slot_at(const FramePool *pool, const uint8_t *data);
+/* Frees the stored slots; those the decoder holds stay out of use. */
+void frame_pool_reset(FramePool *pool);
+
+/* start of a slot, slotSize bytes holding every plane */
+uint8_t *frame_pool_slot(const FramePool *pool, int slot);
+void frame_pool_planes(const FramePool *pool, int slot, uint8_t *data[4]);
+/* Lays the pool's plane layout over memory owned by someone else (a spill
+ * file record, for instance). */
+void frame_pool_planes_at(const FramePool *pool, uint8_t *base,
+                          uint8_t *data[4]);
+
+/* Copies a decoded picture of any size and format into the pool planes at
+ * data, converting in the same pass where there is a fast path: NV12/NV21,
+ * 8-bit planar 4:2:2 and 4:4:4, and 9 to 16-bit planar 4:2:0 into an 8-bit
+ * 4:2:0 pool, and rescaling 8-bit 4:2:0. Returns 0 for a plain copy, 1 for
+ * a conversion and -1 when there is no fast path (use swscale). */
+int frame_pool_store(const FramePool *pool, uint8_t *data[4],
+                     uint8_t *const src[4], const int srcLinesize[4],
+                     enum PixelFormat srcFormat, int srcWidth, int srcHeight);
+
+#endif /* FRAME_POOL_H_ */
@@ -0,0 +1,152 @@
+/*
+ * index_cache.c
+ *
+ * Sidecar index of a source file, see index_cache.h.
+ */
+
+#include "index_cache.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/common.h>
+#include <libavutil/crc.h>
+#include <libavutil/mem.h>
+
+#define INDEX_CACHE_KEY_FORMAT \
+  "reverse index 2\nsource %s\nsize %"PRId64" mtime %ld\n"
+
+/* the path of a local source, the file protocol's prefix dropped */
+static const char *index_cache_file_path(const char *src) {
+  return av_strstart(src, "file:", NULL) ? src + strlen("file:") : src;
+}
+
+/* sources of the same name in other directories get their own */
+static char *index_cache_sidecar(const char *path, const char *dir) {
+  const char *name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+  return av_asprintf("%s/%s.%08x.idx", dir, name,
+                     av_crc(av_crc_get_table(AV_CRC_32_IEEE), 0,
+                            (const uint8_t *) path, strlen(path)));
+}
+
+static void index_cache_clear(IndexCache *cache) {
+  packet_index_free(&cache->index);
+  packet_index_init(&cache->index);
+  cache->indexStream = -1;
+}
+
+/* the key, then a line per packet after the count */
+static int index_cache_read(IndexCache *cache, FILE *file) {
+  size_t keyLength = strlen(cache->key);
+  char *key = av_malloc(keyLength);
+  PacketIndexEntry entry;
+  int stream, count, i;
+  int64_t lastPts, lastDuration;
+  int match = key && fread(key, 1, keyLength, file) == keyLength &&
+              !memcmp(key, cache->key, keyLength);
+  av_free(key);
+  if (!match ||
+      fscanf(file, "packets %d %d %"SCNd64" %"SCNd64"\n", &stream, &count,
+             &lastPts, &lastDuration) != 4 ||
+      stream < 0 || count < 0) {
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    if (fscanf(file, "%"SCNd64" %"SCNd64" %"SCNd64" %d %d %d\n", &entry.pts,
+               &entry.dts, &entry.pos, &entry.size, &entry.flags,
+               &entry.duration) != 6 ||
+        packet_index_append_entry(&cache->index, &entry) < 0) {
+      return -1;
+    }
+  }
+  cache->index.lastPts = lastPts;
+  cache->index.lastDuration = lastDuration;
+  cache->indexStream = stream;
+  return 0;
+}
+
+void index_cache_init(IndexCache *cache) {
+  memset(cache, 0, sizeof(*cache));
+  packet_index_init(&cache->index);
+  cache->indexStream = -1;
+}
+
+int index_cache_open(IndexCache *cache, const char *src, const char *dir) {
+  const char *path = index_cache_file_path(src);
+  struct stat st;
+  FILE *file;
+  index_cache_init(cache);
+  if (!dir || stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+    return -1;
+  }
+  cache->path = index_cache_sidecar(path, dir);
+  cache->key = av_asprintf(INDEX_CACHE_KEY_FORMAT, path, (int64_t) st.st_size,
+                           (long) st.st_mtime);
+  if (!cache->path || !cache->key) {
+    index_cache_free(cache);
+    return -1;
+  }
+  if (!(file = fopen(cache->path, "rb"))) {
+    return 0;
+  }
+  if (index_cache_read(cache, file) < 0) {
+    /* stale or torn: it is rewritten */
+    index_cache_clear(cache);
+  }
+  fclose(file);
+  return cache->indexStream >= 0;
+}
+
+int index_cache_save(IndexCache *cache, int stream_index,
+                     const PacketIndex *index) {
+  char *temp;
+  FILE *file = NULL;
+  int fd, i, err = -1;
+  if (!cache->path) {
+    return -1;
+  }
+  /* written aside and renamed over it, readers never see half of it */
+  temp = av_asprintf("%s.XXXXXX", cache->path);
+  if (!temp || (fd = mkstemp(temp)) < 0) {
+    av_free(temp);
+    return -1;
+  }
+  if (!(file = fdopen(fd, "wb"))) {
+    close(fd);
+  } else if (fputs(cache->key, file) >= 0 &&
+             fprintf(file, "packets %d %d %"PRId64" %"PRId64"\n",
+                     stream_index, index->count, index->lastPts,
+                     index->lastDuration) >= 0) {
+    err = 0;
+    for (i = 0; i < index->count && err == 0; i++) {
+      const PacketIndexEntry *entry = &index->entries[i];
+      if (fprintf(file, "%"PRId64" %"PRId64" %"PRId64" %d %d %d\n",
+                  entry->pts, entry->dts, entry->pos, entry->size,
+                  entry->flags, entry->duration) < 0) {
+        err = -1;
+      }
+    }
+  }
+  if (file && fclose(file) != 0) {
+    err = -1;
+  }
+  if (err == 0 && rename(temp, cache->path) < 0) {
+    err = -1;
+  }
+  if (err < 0) {
+    unlink(temp);
+  }
+  av_free(temp);
+  return err;
+}
+
+void index_cache_free(IndexCache *cache) {
+  packet_index_free(&cache->index);
+  av_freep(&cache->path);
+  av_freep(&cache->key);
+}
@@ -0,0 +1,42 @@
+/*
+ * index_cache.h
+ *
+ * Sidecar file keeping the packet index of one stream of a source file,
+ * which otherwise takes a demux pass over the whole file. It lives in a
+ * directory the caller gives (an app-private cache directory on Android)
+ * and is keyed by the source's path, size and mtime; one that does not
+ * match is ignored and rewritten.
+ */
+
+#ifndef INDEX_CACHE_H_
+#define INDEX_CACHE_H_
+
+#include <stdint.h>
+#include "packet_index.h"
+
+typedef struct IndexCache {
+  /* the sidecar and the source's key, NULL when it is not a local file */
+  char *path;
+  char *key;
+  /* the stream the loaded packets are of, -1 for none */
+  int indexStream;
+  PacketIndex index;
+} IndexCache;
+
+/* An empty cache, for a source that is not looked up. */
+void index_cache_init(IndexCache *cache);
+
+/* Looks for the sidecar of src in dir. Returns 1 when it matched and its
+ * packets were loaded, 0 when there is none yet and -1 when src is not a
+ * file that can be cached. */
+int index_cache_open(IndexCache *cache, const char *src, const char *dir);
+
+/* Records the packets index holds of stream_index, which must be all of
+ * them (packet_index_build()). The sidecar is replaced at once,
+ * atomically. */
+int index_cache_save(IndexCache *cache, int stream_index,
+                     const PacketIndex *index);
+
+void index_cache_free(IndexCache *cache);
+
+#endif /* INDEX_CACHE_H_ */
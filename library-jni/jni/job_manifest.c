@@ -0,0 +1,133 @@
+/*
+ * job_manifest.c
+ *
+ * Progress file of resumable reverse jobs, see job_manifest.h.
+ */
+
+#include "job_manifest.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/avstring.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+#define JOB_MANIFEST_PIECE_FORMAT \
+  "piece %d %d %d %d %"PRId64" %"PRId64" %"PRId64" %"PRId64" %"PRId64"\n"
+
+static char *job_manifest_read(const char *path) {
+  FILE *file = fopen(path, "rb");
+  char *text = NULL;
+  long size;
+  if (!file) {
+    return NULL;
+  }
+  if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0 &&
+      fseek(file, 0, SEEK_SET) == 0 && (text = av_malloc(size + 1))) {
+    text[fread(text, 1, size, file)] = '\0';
+  }
+  fclose(file);
+  return text;
+}
+
+static int job_manifest_write_piece(FILE *file, const JobManifestPiece *p) {
+  return fprintf(file, JOB_MANIFEST_PIECE_FORMAT, p->worker, p->segment,
+                 p->forward, p->frames, p->startPts, p->offset, p->end,
+                 p->pcmOffset, p->samples) < 0 ? -1 : 0;
+}
+
+/* the pieces after the header; a line cut short by a killed job ends them */
+static int job_manifest_parse(const char *text, JobManifestPiece **pieces) {
+  int count = 0, capacity = 0;
+  const char *line = text;
+  const char *next;
+  *pieces = NULL;
+  while ((next = strchr(line, '\n')) != NULL) {
+    JobManifestPiece piece;
+    if (sscanf(line, "piece %d %d %d %d %"SCNd64" %"SCNd64" %"SCNd64
+               " %"SCNd64" %"SCNd64, &piece.worker, &piece.segment,
+               &piece.forward, &piece.frames, &piece.startPts, &piece.offset,
+               &piece.end, &piece.pcmOffset, &piece.samples) != 9) {
+      break;
+    }
+    if (count == capacity) {
+      JobManifestPiece *grown;
+      capacity = FFMAX(capacity * 2, 16);
+      grown = av_realloc(*pieces, capacity * sizeof(JobManifestPiece));
+      if (!grown) {
+        break;
+      }
+      *pieces = grown;
+    }
+    (*pieces)[count++] = piece;
+    line = next + 1;
+  }
+  return count;
+}
+
+int job_manifest_open(JobManifest *manifest, const char *path,
+                      const char *header, JobManifestPiece **pieces) {
+  char *text = job_manifest_read(path);
+  size_t headerLength = strlen(header);
+  char *temp;
+  int count = 0, i;
+  memset(manifest, 0, sizeof(*manifest));
+  *pieces = NULL;
+  if (text && !strncmp(text, header, headerLength)) {
+    count = job_manifest_parse(text + headerLength, pieces);
+  }
+  av_free(text);
+  manifest->path = av_strdup(path);
+  if (!manifest->path) {
+    av_freep(pieces);
+    return -1;
+  }
+  pthread_mutex_init(&manifest->mutex, NULL);
+  /* rewritten either way, without a torn last line, and renamed over the
+   * old one so a job killed meanwhile still finds it */
+  temp = av_asprintf("%s.tmp", path);
+  manifest->file = temp ? fopen(temp, "w") : NULL;
+  if (manifest->file && fputs(header, manifest->file) >= 0) {
+    for (i = 0; i < count; i++) {
+      job_manifest_write_piece(manifest->file, &(*pieces)[i]);
+    }
+    if (fflush(manifest->file) == 0 && rename(temp, path) == 0) {
+      av_free(temp);
+      return count;
+    }
+  }
+  if (temp) {
+    unlink(temp);
+    av_free(temp);
+  }
+  job_manifest_close(manifest, 0);
+  av_freep(pieces);
+  return -1;
+}
+
+int job_manifest_add(JobManifest *manifest, const JobManifestPiece *piece) {
+  int err;
+  pthread_mutex_lock(&manifest->mutex);
+  err = job_manifest_write_piece(manifest->file, piece);
+  if (err == 0 && fflush(manifest->file) != 0) {
+    err = -1;
+  }
+  pthread_mutex_unlock(&manifest->mutex);
+  return err;
+}
+
+void job_manifest_close(JobManifest *manifest, int remove) {
+  if (!manifest->path) {
+    return;
+  }
+  if (manifest->file) {
+    fclose(manifest->file);
+    manifest->file = NULL;
+  }
+  if (remove) {
+    unlink(manifest->path);
+  }
+  pthread_mutex_destroy(&manifest->mutex);
+  av_freep(&manifest->path);
+}
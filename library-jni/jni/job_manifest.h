@@ -0,0 +1,47 @@
+/*
+ * job_manifest.h
+ *
+ * Text file recording the progress of a resumable reverse job: a header
+ * describing the job (source fingerprint, options and segment plan) and
+ * one line per chunk piece written to disk, appended as pieces complete.
+ * A restarted job with the same header picks up the recorded pieces.
+ */
+
+#ifndef JOB_MANIFEST_H_
+#define JOB_MANIFEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct JobManifestPiece {
+  int worker;
+  int segment;
+  int forward;
+  int frames;
+  int64_t startPts;
+  /* bytes of the worker's chunk, samples of its PCM chunk */
+  int64_t offset;
+  int64_t end;
+  int64_t pcmOffset;
+  int64_t samples;
+} JobManifestPiece;
+
+typedef struct JobManifest {
+  char *path;
+  FILE *file;
+  pthread_mutex_t mutex;
+} JobManifest;
+
+/* Opens the manifest at path. When the file starts with header, the pieces
+ * it records are returned in *pieces (av_malloc'ed, in the order they were
+ * added) and new ones are appended; otherwise it is rewritten with header
+ * alone. Returns the number of pieces, -1 when the file cannot be written. */
+int job_manifest_open(JobManifest *manifest, const char *path,
+                      const char *header, JobManifestPiece **pieces);
+/* Appends a piece and flushes it, from any thread. */
+int job_manifest_add(JobManifest *manifest, const JobManifestPiece *piece);
+/* Closes the file; with remove the job is done and it is deleted. */
+void job_manifest_close(JobManifest *manifest, int remove);
+
+#endif /* JOB_MANIFEST_H_ */
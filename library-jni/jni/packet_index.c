@@ -0,0 +1,245 @@
+/*
+ * packet_index.c
+ *
+ * Demux-only packet index used to plan reverse segments without decoding.
+ */
+
+#include "packet_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PACKET_INDEX_INITIAL_CAPACITY 1024
+
+void packet_index_init(PacketIndex *index) {
+  memset(index, 0, sizeof(*index));
+}
+
+void packet_index_free(PacketIndex *index) {
+  av_freep(&index->entries);
+  av_freep(&index->displayPts);
+  index->count = 0;
+  index->capacity = 0;
+  index->keyframeCount = 0;
+  index->lastDuration = 0;
+}
+
+int packet_index_append(PacketIndex *index, const AVPacket *pkt) {
+  PacketIndexEntry entry;
+  entry.pts = pkt->pts;
+  entry.dts = pkt->dts;
+  entry.pos = pkt->pos;
+  entry.size = pkt->size;
+  entry.flags = pkt->flags;
+  entry.duration = pkt->duration;
+  return packet_index_append_entry(index, &entry);
+}
+
+int packet_index_append_entry(PacketIndex *index,
+                              const PacketIndexEntry *entry) {
+  if (index->count == index->capacity) {
+    int capacity = index->capacity ? index->capacity * 2
+                                   : PACKET_INDEX_INITIAL_CAPACITY;
+    PacketIndexEntry *entries = av_realloc(index->entries,
+                                           capacity * sizeof(*entries));
+    if (!entries) {
+      return AVERROR(ENOMEM);
+    }
+    index->entries = entries;
+    index->capacity = capacity;
+  }
+  index->entries[index->count++] = *entry;
+  if (entry->flags & AV_PKT_FLAG_KEY) {
+    index->keyframeCount++;
+  }
+  if (entry->pts != AV_NOPTS_VALUE &&
+      (index->count == 1 || entry->pts >= index->lastPts)) {
+    index->lastPts = entry->pts;
+    index->lastDuration = entry->duration;
+  }
+  return 0;
+}
+
+static int compare_pts(const void *a, const void *b) {
+  int64_t pa = *(const int64_t *) a;
+  int64_t pb = *(const int64_t *) b;
+  return pa < pb ? -1 : pa > pb;
+}
+
+int packet_index_build_display_order(PacketIndex *index) {
+  int i;
+  av_freep(&index->displayPts);
+  for (i = 0; i < index->count; i++) {
+    if (index->entries[i].pts == AV_NOPTS_VALUE) {
+      return AVERROR(EINVAL);
+    }
+  }
+  index->displayPts = av_malloc(FFMAX(index->count, 1) * sizeof(int64_t));
+  if (!index->displayPts) {
+    return AVERROR(ENOMEM);
+  }
+  for (i = 0; i < index->count; i++) {
+    index->displayPts[i] = index->entries[i].pts;
+  }
+  qsort(index->displayPts, index->count, sizeof(int64_t), compare_pts);
+  return 0;
+}
+
+int packet_index_display_pos(const PacketIndex *index, int64_t pts) {
+  int low = 0;
+  int high = index->count;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (index->displayPts[mid] < pts) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/* An open GOP: packets decoded after its keyframe but shown before it, the
+ * leading frames, which reference the GOP before. */
+static int packet_index_open_gop(const PacketIndex *index, int key) {
+  const PacketIndexEntry *keyframe = &index->entries[key];
+  int i;
+  if (keyframe->pts == AV_NOPTS_VALUE) {
+    return 0;
+  }
+  for (i = key + 1; i < index->count; i++) {
+    const PacketIndexEntry *entry = &index->entries[i];
+    if (entry->flags & AV_PKT_FLAG_KEY) {
+      break;
+    }
+    if (entry->pts != AV_NOPTS_VALUE && entry->pts < keyframe->pts) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int packet_index_build(PacketIndex *index, AVFormatContext *ctx,
+                       int stream_index) {
+  return packet_index_build_range(index, ctx, stream_index,
+                                  AV_NOPTS_VALUE, AV_NOPTS_VALUE);
+}
+
+static int packet_index_pass(PacketIndex *index, AVFormatContext *ctx,
+                             int stream_index, int64_t start_ts,
+                             int64_t end_ts) {
+  AVPacket pkt;
+  enum AVDiscard *discard;
+  unsigned int i;
+  int err = 0;
+
+  discard = av_malloc(ctx->nb_streams * sizeof(*discard));
+  if (!discard) {
+    return AVERROR(ENOMEM);
+  }
+  for (i = 0; i < ctx->nb_streams; i++) {
+    discard[i] = ctx->streams[i]->discard;
+    if (i != (unsigned int) stream_index) {
+      ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+  if (start_ts != AV_NOPTS_VALUE &&
+      av_seek_frame(ctx, stream_index, start_ts, AVSEEK_FLAG_BACKWARD) < 0) {
+    /* index from the current position, the caller trims by pts anyway */
+    av_log(ctx, AV_LOG_WARNING, "packet index: seek to %"PRId64" failed\n",
+           start_ts);
+  }
+
+  while (1) {
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    if (av_read_frame(ctx, &pkt) < 0) {
+      break;
+    }
+    if (pkt.stream_index == stream_index) {
+      int64_t ts = pkt.dts != AV_NOPTS_VALUE ? pkt.dts : pkt.pts;
+      if (end_ts != AV_NOPTS_VALUE && (pkt.flags & AV_PKT_FLAG_KEY) &&
+          ts != AV_NOPTS_VALUE && ts >= end_ts) {
+        if (index->count > 0 && pkt.pts != AV_NOPTS_VALUE &&
+            pkt.pts > index->lastPts) {
+          index->lastDuration = pkt.pts - index->lastPts;
+        }
+        av_free_packet(&pkt);
+        break;
+      }
+      err = packet_index_append(index, &pkt);
+    }
+    av_free_packet(&pkt);
+    if (err < 0) {
+      break;
+    }
+  }
+
+  for (i = 0; i < ctx->nb_streams; i++) {
+    ctx->streams[i]->discard = discard[i];
+  }
+  av_free(discard);
+  return err < 0 ? err : index->count;
+}
+
+int packet_index_build_range(PacketIndex *index, AVFormatContext *ctx,
+                             int stream_index, int64_t start_ts,
+                             int64_t end_ts) {
+  const PacketIndexEntry *first;
+  int64_t ts;
+  int ret = packet_index_pass(index, ctx, stream_index, start_ts, end_ts);
+  if (ret <= 0 || start_ts == AV_NOPTS_VALUE) {
+    return ret;
+  }
+  first = &index->entries[0];
+  ts = first->dts != AV_NOPTS_VALUE ? first->dts : first->pts;
+  if (!(first->flags & AV_PKT_FLAG_KEY) || ts == AV_NOPTS_VALUE ||
+      !packet_index_open_gop(index, 0)) {
+    return ret;
+  }
+  /* the leading frames of an open GOP need the one before it decoded */
+  packet_index_free(index);
+  packet_index_init(index);
+  return packet_index_pass(index, ctx, stream_index, ts - 1, end_ts);
+}
+
+int packet_index_slice(PacketIndex *index, const PacketIndex *full,
+                       int64_t start_ts, int64_t end_ts) {
+  int first = 0;
+  int i, err;
+  if (start_ts != AV_NOPTS_VALUE) {
+    /* by pts, the frames of a closed GOP are shown from its keyframe on */
+    for (i = 0; i < full->count; i++) {
+      const PacketIndexEntry *entry = &full->entries[i];
+      int64_t ts = entry->pts != AV_NOPTS_VALUE ? entry->pts : entry->dts;
+      if ((entry->flags & AV_PKT_FLAG_KEY) && ts != AV_NOPTS_VALUE &&
+          ts <= start_ts) {
+        first = i;
+      }
+    }
+    /* the leading frames of an open GOP need the one before it decoded */
+    if (first > 0 && packet_index_open_gop(full, first)) {
+      first--;
+      while (first > 0 && !(full->entries[first].flags & AV_PKT_FLAG_KEY)) {
+        first--;
+      }
+    }
+  }
+  for (i = first; i < full->count; i++) {
+    const PacketIndexEntry *entry = &full->entries[i];
+    int64_t ts = entry->dts != AV_NOPTS_VALUE ? entry->dts : entry->pts;
+    if (end_ts != AV_NOPTS_VALUE && (entry->flags & AV_PKT_FLAG_KEY) &&
+        ts != AV_NOPTS_VALUE && ts >= end_ts) {
+      if (index->count > 0 && entry->pts != AV_NOPTS_VALUE &&
+          entry->pts > index->lastPts) {
+        index->lastDuration = entry->pts - index->lastPts;
+      }
+      break;
+    }
+    if ((err = packet_index_append_entry(index, entry)) < 0) {
+      return err;
+    }
+  }
+  return index->count;
+}
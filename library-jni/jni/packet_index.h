@@ -0,0 +1,77 @@
+/*
+ * packet_index.h
+ *
+ * Compact in-memory index of the packets of one stream, built by a
+ * demux-only pass (no decoding). Entries are kept in file (decode) order.
+ */
+
+#ifndef PACKET_INDEX_H_
+#define PACKET_INDEX_H_
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+typedef struct PacketIndexEntry {
+  int64_t pts;
+  int64_t dts;
+  int64_t pos;
+  int     size;
+  int     flags;
+  int     duration;
+} PacketIndexEntry;
+
+typedef struct PacketIndex {
+  PacketIndexEntry *entries;
+  int count;
+  int capacity;
+  int keyframeCount;
+  /* presentation timestamps sorted in display order, see
+   * packet_index_build_display_order() */
+  int64_t *displayPts;
+  /* pts of the packet shown last and how long it is shown: its duration,
+   * or until the keyframe a range index stopped at; 0 when not known */
+  int64_t lastPts;
+  int64_t lastDuration;
+} PacketIndex;
+
+void packet_index_init(PacketIndex *index);
+void packet_index_free(PacketIndex *index);
+
+int packet_index_append(PacketIndex *index, const AVPacket *pkt);
+int packet_index_append_entry(PacketIndex *index,
+                              const PacketIndexEntry *entry);
+
+/* Reads every packet of the file and records the ones belonging to
+ * stream_index. Other streams are discarded by the demuxer while the pass
+ * runs, so their payload is not read. Returns the number of entries or a
+ * negative AVERROR. The caller has to seek back before decoding. */
+int packet_index_build(PacketIndex *index, AVFormatContext *ctx,
+                       int stream_index);
+
+/* Same as packet_index_build() for the packets around [start_ts, end_ts)
+ * only (stream time base, AV_NOPTS_VALUE leaves a side open): the pass
+ * starts at the keyframe before start_ts, or at the one before that when
+ * its GOP is open (frames decoded after the keyframe but shown before it
+ * reference the previous GOP), and stops at the first keyframe decoded at
+ * or after end_ts, after which no packet can be shown earlier. */
+int packet_index_build_range(PacketIndex *index, AVFormatContext *ctx,
+                             int stream_index, int64_t start_ts,
+                             int64_t end_ts);
+
+/* Same as packet_index_build_range() from an index of the whole stream
+ * (one built by packet_index_build()), without reading the file: its
+ * packets from the last keyframe shown at or before start_ts, or from the
+ * one before it when its GOP is open. */
+int packet_index_slice(PacketIndex *index, const PacketIndex *full,
+                       int64_t start_ts, int64_t end_ts);
+
+/* Sorts the presentation timestamps so a decoded frame can be mapped back to
+ * its display position. Returns a negative value when some packet carries no
+ * pts; the caller then has to count decoded frames instead. */
+int packet_index_build_display_order(PacketIndex *index);
+
+/* Display position of the frame presented at pts (the first position whose
+ * pts is not smaller). Needs packet_index_build_display_order(). */
+int packet_index_display_pos(const PacketIndex *index, int64_t pts);
+
+#endif /* PACKET_INDEX_H_ */
@@ -56,6 +56,8 @@
 #include "aes-protocol.h"
 #include "sync.h"
 #include "reverse.h"
+#include "reverse_queue.h"
+#include "decoder_threads.h"
 
 #define FFMPEG_LOG_LEVEL AV_LOG_WARNING
 #define LOG_LEVEL 2
@@ -206,6 +208,9 @@ struct Player {
 	AVFormatContext *input_format_ctx;
 	int input_inited;
 
+	// "decoder_threads" and "decoder_thread_type" of the data source
+	DecoderThreads decoder_threads;
+
 	jobject audio_track;
 	enum AVSampleFormat audio_track_format;
 	int audio_track_channel_count;
@@ -799,12 +804,21 @@ int player_decode_video(struct DecoderData * decoder_data, JNIEnv * env,
 #endif // MEASURE_TIME
 	LOGI(10, "player_decode_video decoding");
 	int frameFinished;
+	AVPacket *packet = packet_data->packet;
+	AVPacket drain_packet;
+	if (packet_data->end_of_stream) {
+		// empty packets drain the frames the decoder still holds back,
+		// one per frame thread, one frame per call
+		av_init_packet(&drain_packet);
+		drain_packet.data = NULL;
+		drain_packet.size = 0;
+		packet = &drain_packet;
+	}
 
 #ifdef MEASURE_TIME
 	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &timespec1);
 #endif // MEASURE_TIME
-	int ret = avcodec_decode_video2(ctx, frame, &frameFinished,
-			packet_data->packet);
+	int ret = avcodec_decode_video2(ctx, frame, &frameFinished, packet);
 
 #ifdef MEASURE_TIME
 	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &timespec2);
@@ -1023,7 +1037,8 @@ int player_decode_video(struct DecoderData * decoder_data, JNIEnv * env,
 
 	ANativeWindow_unlockAndPost(window);
 skip_frame:
-	return err;
+	// a frame came out, at the end of the stream there may be more
+	return err < 0 ? err : 1;
 }
 
 void * player_decode(void * data) {
@@ -1082,7 +1097,9 @@ void * player_decode(void * data) {
 		if (codec_type == AVMEDIA_TYPE_AUDIO) {
 			err = player_decode_audio(decoder_data, env, packet_data);
 		} else if (codec_type == AVMEDIA_TYPE_VIDEO) {
-			err = player_decode_video(decoder_data, env, packet_data);
+			do {
+				err = player_decode_video(decoder_data, env, packet_data);
+			} while (packet_data->end_of_stream && err > 0);
 		} else
 #ifdef SUBTITLES
 		if (codec_type == AVMEDIA_TYPE_SUBTITLE) {
@@ -1404,7 +1421,8 @@ void * player_read_from_stream(void *data) {
 		}
 
 		LOGI(3, "player_read_from_stream flushing internal codec bffers");
-		// flush internal buffers
+		// flush internal buffers, this also drops the frames the frame
+		// threads still hold from before the seek
 		for (stream_no = 0; stream_no < caputre_streams_no; ++stream_no) {
 			avcodec_flush_buffers(player->input_codec_ctxs[stream_no]);
 		}
@@ -1553,13 +1571,9 @@ int player_open_stream(struct Player *player, AVCodecContext * ctx,
 		return -ERROR_COULD_NOT_FIND_VIDEO_CODEC;
 	}
 
-    //enable multi-thread decode video, 
-    //the thread_count should be match with the cpu cores,
-    //you can get this form java or use cpufeature lib
-    //here I am fixed it with 4.
-    if (ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
-        ctx->thread_count = 4;
-    }
+	if (ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+		decoder_threads_apply(&player->decoder_threads, ctx, 1);
+	}
 
 	if (avcodec_open2(ctx, *codec, NULL) < 0) {
 		LOGE(1, "Could not open codec");
@@ -1570,6 +1584,10 @@ int player_open_stream(struct Player *player, AVCodecContext * ctx,
 	LOGI(3,
 			"player_open_stream opened: %d, name: %s, long_name: %s",
 			codec_id, (*codec)->name, (*codec)->long_name);
+	if (ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+		LOGI(3, "player_open_stream decoder threads: %d, frame delay: %d",
+				ctx->thread_count, decoder_threads_delay(ctx));
+	}
 	return 0;
 }
 
@@ -2394,6 +2412,12 @@ int player_set_data_source(struct State *state, const char *file_path,
 		font_path[length] = '\0';
 	}
 #endif // SUBTITLES
+	// read before player_open_input(), which hands the dictionary to
+	// avformat_open_input()
+	player->decoder_threads.count = 0;
+	player->decoder_threads.mode = DECODER_THREADS_AUTO;
+	decoder_threads_read(&player->decoder_threads, dictionary);
+
 	// initial setup
 	player->pause = TRUE;
 	player->start_time = 0;
@@ -2663,17 +2687,160 @@ void jni_player_read_dictionary(JNIEnv *env, AVDictionary **dictionary,
 int jni_player_reverse(JNIEnv *env, jobject thiz, jstring stringSrc,
 		jstring stringDesc, jlong positionUsStart, jlong positionUsEnd,
 		int video_stream_no, int audio_stream_no,
-		int subtitle_stream_no) {
+		int subtitle_stream_no, jobject dictionary) {
+		AVDictionary *dict = NULL;
+		if (dictionary != NULL) {
+			jni_player_read_dictionary(env, &dict, dictionary);
+			(*env)->DeleteLocalRef(env, dictionary);
+		}
 		const char *file_path_src = (*env)->GetStringUTFChars(env, stringSrc, NULL);
 		const char *file_path_desc = (*env)->GetStringUTFChars(env, stringDesc, NULL);
     int ret = reverse(file_path_src, file_path_desc,
       positionUsStart, positionUsEnd,
-      video_stream_no, audio_stream_no, subtitle_stream_no);
+      video_stream_no, audio_stream_no, subtitle_stream_no, dict);
     (*env)->ReleaseStringUTFChars(env, stringSrc, file_path_src);
     (*env)->ReleaseStringUTFChars(env, stringDesc, file_path_desc);
+    av_dict_free(&dict);
     return ret;
 }
 
+jlong jni_player_reverse_create(JNIEnv *env, jobject thiz, jstring stringSrc,
+		jstring stringDesc, jlong positionUsStart, jlong positionUsEnd,
+		int video_stream_no, int audio_stream_no,
+		int subtitle_stream_no, jobject dictionary) {
+	AVDictionary *dict = NULL;
+	if (dictionary != NULL) {
+		jni_player_read_dictionary(env, &dict, dictionary);
+		(*env)->DeleteLocalRef(env, dictionary);
+	}
+	const char *file_path_src = (*env)->GetStringUTFChars(env, stringSrc, NULL);
+	const char *file_path_desc = (*env)->GetStringUTFChars(env, stringDesc, NULL);
+	ReverseContext *ctx = reverse_context_create(file_path_src, file_path_desc,
+			positionUsStart, positionUsEnd,
+			video_stream_no, audio_stream_no, subtitle_stream_no, dict);
+	(*env)->ReleaseStringUTFChars(env, stringSrc, file_path_src);
+	(*env)->ReleaseStringUTFChars(env, stringDesc, file_path_desc);
+	av_dict_free(&dict);
+	if (ctx == NULL) {
+		throw_runtime_exception(env, "Could not allocate reverse context");
+		return 0;
+	}
+	return (jlong) (intptr_t) ctx;
+}
+
+struct ReverseFragmentTarget {
+	JNIEnv *env;
+	jobject thiz;
+	jmethodID method;
+};
+
+/* "progressive" jobs: every fragment written goes to
+ * onReverseFragment() of the object running it, on the thread running the
+ * job */
+static void jni_player_reverse_fragment(void *opaque,
+		const ReverseFragment *fragment) {
+	struct ReverseFragmentTarget *target = opaque;
+	(*target->env)->CallVoidMethod(target->env, target->thiz, target->method,
+			fragment->index, (jlong) fragment->offset, (jlong) fragment->size,
+			(jlong) fragment->endUs, fragment->last ? JNI_TRUE : JNI_FALSE);
+}
+
+int jni_player_reverse_run(JNIEnv *env, jobject thiz, jlong handle) {
+	ReverseContext *ctx = (ReverseContext *) (intptr_t) handle;
+	struct ReverseFragmentTarget target;
+	jclass player_class;
+	int ret;
+	target.env = env;
+	target.thiz = thiz;
+	target.method = NULL;
+	if (reverse_context_progressive(ctx)) {
+		player_class = (*env)->GetObjectClass(env, thiz);
+		target.method = java_get_method(env, player_class,
+				player_on_reverse_fragment);
+		(*env)->DeleteLocalRef(env, player_class);
+		if (target.method == NULL) {
+			// no listener to report to, the output is written all the same
+			(*env)->ExceptionClear(env);
+			LOGW(3, "jni_player_reverse_run: no onReverseFragment, fragments not reported");
+		}
+	}
+	if (target.method != NULL) {
+		reverse_context_set_fragment_callback(ctx, jni_player_reverse_fragment,
+				&target);
+	}
+	ret = reverse_context_run(ctx);
+	reverse_context_set_fragment_callback(ctx, NULL, NULL);
+	return ret;
+}
+
+jdouble jni_player_reverse_encode_fps(JNIEnv *env, jobject thiz, jlong handle) {
+	return reverse_context_encode_fps((ReverseContext *) (intptr_t) handle);
+}
+
+void jni_player_reverse_cancel(JNIEnv *env, jobject thiz, jlong handle) {
+	reverse_context_cancel((ReverseContext *) (intptr_t) handle);
+}
+
+void jni_player_reverse_destroy(JNIEnv *env, jobject thiz, jlong handle) {
+	reverse_context_destroy((ReverseContext *) (intptr_t) handle);
+}
+
+jlong jni_player_reverse_queue_create(JNIEnv *env, jobject thiz, jint threads,
+		jlong memoryBudget) {
+	ReverseQueue *queue = reverse_queue_create(threads, memoryBudget);
+	if (queue == NULL) {
+		throw_runtime_exception(env, "Could not create reverse queue");
+		return 0;
+	}
+	return (jlong) (intptr_t) queue;
+}
+
+jint jni_player_reverse_queue_submit(JNIEnv *env, jobject thiz, jlong queue,
+		jstring stringSrc, jstring stringDesc, jlong positionUsStart,
+		jlong positionUsEnd, int video_stream_no, int audio_stream_no,
+		int subtitle_stream_no, jobject dictionary) {
+	AVDictionary *dict = NULL;
+	if (dictionary != NULL) {
+		jni_player_read_dictionary(env, &dict, dictionary);
+		(*env)->DeleteLocalRef(env, dictionary);
+	}
+	const char *file_path_src = (*env)->GetStringUTFChars(env, stringSrc, NULL);
+	const char *file_path_desc = (*env)->GetStringUTFChars(env, stringDesc, NULL);
+	int job = reverse_queue_submit((ReverseQueue *) (intptr_t) queue,
+			file_path_src, file_path_desc, positionUsStart, positionUsEnd,
+			video_stream_no, audio_stream_no, subtitle_stream_no, dict);
+	(*env)->ReleaseStringUTFChars(env, stringSrc, file_path_src);
+	(*env)->ReleaseStringUTFChars(env, stringDesc, file_path_desc);
+	av_dict_free(&dict);
+	return job;
+}
+
+jint jni_player_reverse_queue_poll(JNIEnv *env, jobject thiz, jlong queue,
+		jint job) {
+	ReverseJobStatus status;
+	if (reverse_queue_poll((ReverseQueue *) (intptr_t) queue, job, &status) < 0) {
+		return -1;
+	}
+	return status.state;
+}
+
+jint jni_player_reverse_queue_result(JNIEnv *env, jobject thiz, jlong queue,
+		jint job) {
+	ReverseJobStatus status;
+	int err = reverse_queue_poll((ReverseQueue *) (intptr_t) queue, job, &status);
+	return err < 0 ? err : status.result;
+}
+
+void jni_player_reverse_queue_cancel(JNIEnv *env, jobject thiz, jlong queue,
+		jint job) {
+	reverse_queue_cancel((ReverseQueue *) (intptr_t) queue, job);
+}
+
+void jni_player_reverse_queue_release(JNIEnv *env, jobject thiz, jlong queue,
+		jint job) {
+	reverse_queue_release((ReverseQueue *) (intptr_t) queue, job);
+}
+
 int jni_player_set_data_source(JNIEnv *env, jobject thiz, jstring string,
 		jobject dictionary, int video_stream_no, int audio_stream_no,
 		int subtitle_stream_no) {
@@ -98,6 +98,7 @@ static char *player_class_path_name = "com/ffmpegtest/MainActivity";
 //static JavaMethod player_prepare_audio_track = {"prepareAudioTrack", "(II)Landroid/media/AudioTrack;"};
 //static JavaMethod player_prepare_frame = {"prepareFrame", "(II)Landroid/graphics/Bitmap;"};
 //static JavaMethod player_set_stream_info = {"setStreamsInfo", "([Lcom/appunite/ffmpeg/FFmpegStreamInfo;)V"};
+static JavaMethod player_on_reverse_fragment = {"onReverseFragment", "(IJJJZ)V"};
 
 // AudioTrack
 static char *android_track_class_path_name = "android/media/AudioTrack";
@@ -126,7 +127,29 @@ int jni_player_set_data_source(JNIEnv *env, jobject thiz, jstring string,
 int jni_player_reverse(JNIEnv *env, jobject thiz, jstring stringSrc,
 		jstring stringDesc, jlong positionUsStart, jlong positionUsEnd,
 		int video_stream_no, int audio_stream_no,
-		int subtitle_stream_no);
+		int subtitle_stream_no, jobject dictionary);
+jlong jni_player_reverse_create(JNIEnv *env, jobject thiz, jstring stringSrc,
+		jstring stringDesc, jlong positionUsStart, jlong positionUsEnd,
+		int video_stream_no, int audio_stream_no,
+		int subtitle_stream_no, jobject dictionary);
+int jni_player_reverse_run(JNIEnv *env, jobject thiz, jlong handle);
+jdouble jni_player_reverse_encode_fps(JNIEnv *env, jobject thiz, jlong handle);
+void jni_player_reverse_cancel(JNIEnv *env, jobject thiz, jlong handle);
+void jni_player_reverse_destroy(JNIEnv *env, jobject thiz, jlong handle);
+jlong jni_player_reverse_queue_create(JNIEnv *env, jobject thiz, jint threads,
+		jlong memoryBudget);
+jint jni_player_reverse_queue_submit(JNIEnv *env, jobject thiz, jlong queue,
+		jstring stringSrc, jstring stringDesc, jlong positionUsStart,
+		jlong positionUsEnd, int video_stream_no, int audio_stream_no,
+		int subtitle_stream_no, jobject dictionary);
+jint jni_player_reverse_queue_poll(JNIEnv *env, jobject thiz, jlong queue,
+		jint job);
+jint jni_player_reverse_queue_result(JNIEnv *env, jobject thiz, jlong queue,
+		jint job);
+void jni_player_reverse_queue_cancel(JNIEnv *env, jobject thiz, jlong queue,
+		jint job);
+void jni_player_reverse_queue_release(JNIEnv *env, jobject thiz, jlong queue,
+		jint job);
 
 void jni_player_stop(JNIEnv *env, jobject thiz);
 
@@ -147,7 +170,18 @@ static JNINativeMethod player_methods[] = {
 //	{"resumeNative", "()V", (void*) jni_player_resume},
 //
 //	{"setDataSourceNative", "(Ljava/lang/String;Ljava/util/Map;III)I", (void*) jni_player_set_data_source},
-	{"reverseNative", "(Ljava/lang/String;Ljava/lang/String;JJIII)I", (void*) jni_player_reverse},
+	{"reverseNative", "(Ljava/lang/String;Ljava/lang/String;JJIIILjava/util/Map;)I", (void*) jni_player_reverse},
+	{"reverseCreateNative", "(Ljava/lang/String;Ljava/lang/String;JJIIILjava/util/Map;)J", (void*) jni_player_reverse_create},
+	{"reverseRunNative", "(J)I", (void*) jni_player_reverse_run},
+	{"reverseEncodeFpsNative", "(J)D", (void*) jni_player_reverse_encode_fps},
+	{"reverseCancelNative", "(J)V", (void*) jni_player_reverse_cancel},
+	{"reverseDestroyNative", "(J)V", (void*) jni_player_reverse_destroy},
+	{"reverseQueueCreateNative", "(IJ)J", (void*) jni_player_reverse_queue_create},
+	{"reverseQueueSubmitNative", "(JLjava/lang/String;Ljava/lang/String;JJIIILjava/util/Map;)I", (void*) jni_player_reverse_queue_submit},
+	{"reverseQueuePollNative", "(JI)I", (void*) jni_player_reverse_queue_poll},
+	{"reverseQueueResultNative", "(JI)I", (void*) jni_player_reverse_queue_result},
+	{"reverseQueueCancelNative", "(JI)V", (void*) jni_player_reverse_queue_cancel},
+	{"reverseQueueReleaseNative", "(JI)V", (void*) jni_player_reverse_queue_release},
 //	{"stopNative", "()V", (void*) jni_player_stop},
 //
 //	{"renderFrameStart", "()V", (void*) jni_player_render_frame_start},
@@ -18,6 +18,8 @@
 
 #include "queue.h"
 
+#include <string.h>
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
@@ -0,0 +1,317 @@
+/*
+ * reverse-cli.c
+ *
+ * Runs one reverse() job on a host build (see Makefile.host), so reverse
+ * throughput can be profiled and benchmarked off-device. With -b it prints
+ * the frame rate, the time of every stage and the peak resident memory.
+ * Several src dst pairs are run as a batch through a reverse queue. A
+ * "progressive" job prints every fragment as it is written. With -t the
+ * output's frame times are checked against the source's, mirrored.
+ */
+
+#include "reverse.h"
+#include "reverse_queue.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-s start_us] [-e end_us] [-a audio_stream]\n"
+          "          [-o key=value]... [-j cores] [-m bytes] [-b] [-t] [-v]\n"
+          "          src dst [src dst]...\n"
+          "  -s, -e  reverse only [start_us, end_us) of the source\n"
+          "  -a      audio stream to reverse along, -1 for none (default)\n"
+          "  -o      reverse option, see reverse.h (memory_budget=...)\n"
+          "  -j, -m  cores and memory budget a batch of several jobs shares,\n"
+          "          default all cores and a quarter of the memory\n"
+          "  -b      print frames/s, time per stage and peak RSS\n"
+          "  -t      check that the output frames of a single job are shown at\n"
+          "          the source's frame times, mirrored (source timing, no\n"
+          "          boomerang)\n"
+          "  -v      log the engine's progress\n", name);
+}
+
+static void printStage(const char *name, int64_t us, int64_t wallUs) {
+  printf("%-8s %9.3f s %6.1f%%\n", name, us / 1000000.0,
+         wallUs > 0 ? us * 100.0 / wallUs : 0.0);
+}
+
+static void printFragment(void *opaque, const ReverseFragment *fragment) {
+  printf("fragment %4d %9"PRId64" bytes at %9"PRId64" until %9.3f s%s\n",
+         fragment->index, fragment->size, fragment->offset,
+         fragment->endUs / 1000000.0, fragment->last ? ", done" : "");
+  fflush(stdout);
+}
+
+static void printBenchmark(ReverseContext *ctx) {
+  ReverseStats stats;
+  struct rusage usage;
+  reverse_context_stats(ctx, &stats);
+  getrusage(RUSAGE_SELF, &usage);
+  printf("frames   %9d\n", stats.frames);
+  printf("decoded  %9d %6.2f per frame\n", stats.decodedFrames,
+         stats.frames > 0 ? (double) stats.decodedFrames / stats.frames : 0.0);
+  printf("wall     %9.3f s %6.1f fps\n", stats.wallUs / 1000000.0,
+         stats.wallUs > 0 ? stats.frames * 1000000.0 / stats.wallUs : 0.0);
+  printStage("demux", stats.demuxUs, stats.wallUs);
+  printStage("decode", stats.decodeUs, stats.wallUs);
+  printStage("copy", stats.copyUs, stats.wallUs);
+  printStage("convert", stats.convertUs, stats.wallUs);
+  printStage("encode", stats.encodeUs, stats.wallUs);
+  printStage("audio", stats.audioUs, stats.wallUs);
+  printStage("mux", stats.muxUs, stats.wallUs);
+  /* ru_maxrss is in kilobytes on Linux */
+  printf("peak RSS %9.1f MB\n", usage.ru_maxrss / 1024.0);
+}
+
+static int compareTimestamps(const void *a, const void *b) {
+  int64_t x = *(const int64_t*) a, y = *(const int64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Display times of the first video stream of path, in microseconds from
+ * its start and in ascending order, followed by the end of the last frame,
+ * AV_NOPTS_VALUE when the container does not store its duration. Returns
+ * the number of frames, -1 when path cannot be read. */
+static int readFrameTimes(const char *path, int64_t **times) {
+  AVFormatContext *fc = NULL;
+  AVStream *st;
+  AVPacket pkt;
+  unsigned int size = 0;
+  int64_t start, lastTs = AV_NOPTS_VALUE, lastDuration = 0;
+  int count = 0, stream, i;
+  *times = NULL;
+  if (avformat_open_input(&fc, path, NULL, NULL) < 0) {
+    return -1;
+  }
+  if (avformat_find_stream_info(fc, NULL) < 0 ||
+      (stream = av_find_best_stream(fc, AVMEDIA_TYPE_VIDEO, -1, -1, NULL,
+                                    0)) < 0) {
+    avformat_close_input(&fc);
+    return -1;
+  }
+  st = fc->streams[stream];
+  while (av_read_frame(fc, &pkt) >= 0) {
+    int64_t ts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+    int64_t *grown;
+    if (pkt.stream_index == stream && ts != AV_NOPTS_VALUE &&
+        (grown = av_fast_realloc(*times, &size,
+                                 (count + 2) * sizeof(int64_t)))) {
+      *times = grown;
+      (*times)[count++] = ts;
+      if (lastTs == AV_NOPTS_VALUE || ts > lastTs) {
+        lastTs = ts;
+        lastDuration = pkt.duration;
+      }
+    }
+    av_free_packet(&pkt);
+  }
+  if (count > 0) {
+    qsort(*times, count, sizeof(int64_t), compareTimestamps);
+    (*times)[count] = lastDuration > 0 ? lastTs + lastDuration
+                                       : AV_NOPTS_VALUE;
+    start = st->start_time != AV_NOPTS_VALUE ? st->start_time : (*times)[0];
+    for (i = 0; i <= count; i++) {
+      if ((*times)[i] != AV_NOPTS_VALUE) {
+        (*times)[i] = av_rescale_q((*times)[i] - start, st->time_base,
+                                   AV_TIME_BASE_Q);
+      }
+    }
+  }
+  avformat_close_input(&fc);
+  return count;
+}
+
+/* The frames of src shown in [startUs, endUs), played backwards: each one
+ * starts where the frame after it ended, counted from the range's end. The
+ * output's frames have to start at those times, within a millisecond. When
+ * the source does not store the duration of its last frame, the engine
+ * estimates it and the times are counted from the second output frame. */
+static int checkTiming(const char *src, const char *dst, long startUs,
+                       long endUs) {
+  int64_t *srcTimes, *dstTimes;
+  int srcCount = readFrameTimes(src, &srcTimes);
+  int dstCount = readFrameTimes(dst, &dstTimes);
+  int first = 0, last, anchor = 0, i, bad = -1;
+  if (srcCount <= 0 || dstCount <= 0) {
+    fprintf(stderr, "timing: could not read the frames of %s\n",
+            srcCount <= 0 ? src : dst);
+    av_free(srcTimes);
+    av_free(dstTimes);
+    return 1;
+  }
+  while (startUs > 0 && first < srcCount && srcTimes[first] < startUs) {
+    first++;
+  }
+  for (last = first; last < srcCount; last++) {
+    if (endUs > 0 && srcTimes[last] >= endUs) {
+      break;
+    }
+  }
+  if (srcTimes[last] == AV_NOPTS_VALUE && dstCount > 1) {
+    anchor = 1;
+  }
+  if (last - first != dstCount) {
+    fprintf(stderr, "timing: %d frames, %d expected\n", dstCount,
+            last - first);
+  } else {
+    for (i = anchor; i < dstCount && bad < 0; i++) {
+      int64_t expected = srcTimes[last - anchor] - srcTimes[last - i];
+      int64_t actual = dstTimes[i] - dstTimes[anchor];
+      if (FFABS(actual - expected) > 1000) {
+        fprintf(stderr, "timing: frame %d at %.6f s, expected %.6f s\n", i,
+                actual / 1000000.0, expected / 1000000.0);
+        bad = i;
+      }
+    }
+    if (bad < 0) {
+      printf("timing   %9d frames mirrored\n", dstCount);
+    }
+  }
+  av_free(srcTimes);
+  av_free(dstTimes);
+  return last - first != dstCount || bad >= 0;
+}
+
+/* every pair of paths from first on as a job of one queue */
+static int runBatch(char **paths, int jobCount, long startUs, long endUs,
+                    int audioStream, AVDictionary *options, int cores,
+                    int64_t memoryBudget, int benchmark) {
+  ReverseQueue *queue = reverse_queue_create(cores, memoryBudget);
+  ReverseJobStatus status;
+  struct rusage usage;
+  int64_t start = av_gettime();
+  int *jobs = av_malloc(jobCount * sizeof(int));
+  int failed = 0, frames = 0, i;
+  if (!queue || !jobs) {
+    fprintf(stderr, "out of memory\n");
+    reverse_queue_destroy(queue);
+    av_free(jobs);
+    return 1;
+  }
+  for (i = 0; i < jobCount; i++) {
+    jobs[i] = reverse_queue_submit(queue, paths[2 * i], paths[2 * i + 1],
+                                   startUs, endUs, 1, audioStream, 0, options);
+  }
+  for (i = 0; i < jobCount; i++) {
+    while (jobs[i] > 0 && reverse_queue_poll(queue, jobs[i], &status) == 0 &&
+           status.state != REVERSE_JOB_DONE) {
+      av_usleep(10000);
+    }
+    if (jobs[i] < 0 || status.result < 0) {
+      fprintf(stderr, "reverse of %s failed: %d\n", paths[2 * i],
+              jobs[i] < 0 ? jobs[i] : status.result);
+      failed++;
+    } else {
+      frames += status.stats.frames;
+      if (benchmark) {
+        printf("%-24s %7d frames %9.3f s %6.1f fps\n", paths[2 * i + 1],
+               status.stats.frames, status.stats.wallUs / 1000000.0,
+               status.encodeFps);
+      }
+    }
+    reverse_queue_release(queue, jobs[i]);
+  }
+  reverse_queue_destroy(queue);
+  av_free(jobs);
+  if (benchmark) {
+    int64_t wallUs = av_gettime() - start;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("batch    %9d frames %9.3f s %6.1f fps\n", frames,
+           wallUs / 1000000.0, wallUs > 0 ? frames * 1000000.0 / wallUs : 0.0);
+    printf("peak RSS %9.1f MB\n", usage.ru_maxrss / 1024.0);
+  }
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+  AVDictionary *options = NULL;
+  ReverseContext *ctx;
+  long startUs = 0, endUs = 0;
+  int audioStream = -1;
+  int benchmark = 0;
+  int check = 0;
+  int cores = 0;
+  int64_t memoryBudget = 0;
+  int opt, ret;
+  while ((opt = getopt(argc, argv, "s:e:a:o:j:m:btvh")) != -1) {
+    char *value;
+    switch (opt) {
+    case 's':
+      startUs = atol(optarg);
+      break;
+    case 'e':
+      endUs = atol(optarg);
+      break;
+    case 'a':
+      audioStream = atoi(optarg);
+      break;
+    case 'o':
+      value = strchr(optarg, '=');
+      if (!value) {
+        usage(argv[0]);
+        return 2;
+      }
+      *value++ = '\0';
+      av_dict_set(&options, optarg, value, 0);
+      break;
+    case 'j':
+      cores = atoi(optarg);
+      break;
+    case 'm':
+      memoryBudget = strtoll(optarg, NULL, 10);
+      break;
+    case 'b':
+      benchmark = 1;
+      break;
+    case 't':
+      check = 1;
+      break;
+    case 'v':
+      reverse_log_set_level(ANDROID_LOG_VERBOSE);
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (argc - optind < 2 || (argc - optind) % 2) {
+    usage(argv[0]);
+    return 2;
+  }
+  av_log_set_level(FFMPEG_LOG_LEVEL);
+  if (argc - optind > 2) {
+    ret = runBatch(argv + optind, (argc - optind) / 2, startUs, endUs,
+                   audioStream, options, cores, memoryBudget, benchmark);
+    av_dict_free(&options);
+    return ret;
+  }
+
+  ctx = reverse_context_create(argv[optind], argv[optind + 1], startUs, endUs,
+                               1, audioStream, 0, options);
+  av_dict_free(&options);
+  if (!ctx) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  reverse_context_set_fragment_callback(ctx, printFragment, NULL);
+  ret = reverse_context_run(ctx);
+  if (ret < 0) {
+    fprintf(stderr, "reverse failed: %d\n", ret);
+  } else if (benchmark) {
+    printBenchmark(ctx);
+  }
+  reverse_context_destroy(ctx);
+  if (ret >= 0 && check) {
+    return checkTiming(argv[optind], argv[optind + 1], startUs, endUs);
+  }
+  return ret < 0 ? 1 : 0;
+}
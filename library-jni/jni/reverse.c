@@ -1,5 +1,20 @@
 #include "reverse.h"
+#include "packet_index.h"
+#include "frame_pool.h"
+#include "spill_file.h"
+#include "frame_cache.h"
+#include "queue.h"
+#include "audio_reverse.h"
+#include "decoder_threads.h"
+#include "job_manifest.h"
+#include "index_cache.h"
 
+#include <libavutil/audioconvert.h>
+#include <libavutil/avstring.h>
+#include <libavutil/bprint.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
 #include <libavutil/timestamp.h>
 #include <libswscale/swscale.h>
 
@@ -8,422 +23,3592 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #define STREAM_FRAME_RATE 25 /* 25 images/s */
 #define STREAM_PIX_FMT PIX_FMT_YUV420P /* default pix_fmt */
-int BUFFER_LIST_SIZE = 100;
-
-AVFormatContext *formatContext_src = NULL;
-AVFormatContext *formatContext_dst = NULL;
-AVStream *st_src = NULL;
-AVStream *st_dst = NULL;
-AVCodec *codec_dst = NULL;
-AVCodec *codec_src = NULL;
-AVFrame *frame_src = NULL;
-AVFrame* frame_dst = NULL;
-struct SwsContext* fooContext = NULL;
-int ret = -1;
-int stream_index = -1;
-int frameCount = 0;
-int width, height;
-int encodeFramePos = 0;
-int got_frame = -1;
-
+#define BUFFER_LIST_SIZE 100
+/* writing a frame to the spill file and reading it back, in decodes */
+#define SPILL_FRAME_COST 0.25
 
+/* list nodes live in SegmentBuffer.nodes, one per frame pool slot; next
+ * is the frame stored before, prev the one stored after */
 typedef struct YUVBufferList{
   uint8_t*       data[4];
   void*          next;
+  void*          prev;
 } YUVBufferList;
-YUVBufferList *pHeader = NULL;
 
-int CopyYuv(const uint8_t *buf_src, int wrap, int xsize,
-            int ysize, uint8_t *buf_dst) {
-  int i, pos = 0;
-  for(i = 0; i < ysize; i++) {
-    memcpy((uint8_t*)(&buf_dst[i * xsize]), (uint8_t*)(&buf_src[i * wrap]), xsize);
-    pos = i * xsize;
+/* when a frame is shown, in the source stream's time base */
+typedef struct FrameTiming {
+  int64_t pts;
+  int64_t duration;
+} FrameTiming;
+
+/* display-order frame range, decoded from the keyframe at seekFramePos;
+ * spill segments keep their frames in spillFile instead of the pool */
+typedef struct ReverseSegment {
+  int startFramePos;
+  int endFramePos;
+  int seekFramePos;
+  int64_t seekTimestamp;
+  int spill;
+} ReverseSegment;
+
+/* Frames of one segment on their way from the decoder thread to the
+ * encoder. SEGMENT_BUFFER_COUNT of them circulate between freeBuffers and
+ * filledBuffers, so segment N-1 is decoded while segment N is encoded and
+ * the decoder blocks when it gets too far ahead. With the frame cache the
+ * pool has two slots, the newest frame and the one being decoded, and the
+ * older frames are deltas in cache. */
+typedef struct SegmentBuffer {
+  FramePool pool;
+  YUVBufferList *nodes;
+  YUVBufferList *pHeader;
+  YUVBufferList *pTail;
+  SpillFile spill;
+  int spillFrameCount;
+  FrameCache cache;
+  int newestSlot;
+  int newestPos;
+  int storedFrames;
+  /* PCM of the segment's time span, negative on a decoding error */
+  AudioBuffer audio;
+  int storedAudio;
+  /* the frames held: the segment, or its tail when the cache ran full */
+  ReverseSegment part;
+  const ReverseSegment *segment;
+  /* index of the planned segment part belongs to */
+  int segmentIndex;
+  /* with source timing, the timing of each frame in the order stored, or
+   * by display position with the frame cache, see cachedTimingIndex() */
+  FrameTiming *timings;
+  unsigned int timingsSize;
+} SegmentBuffer;
+#define SEGMENT_BUFFER_COUNT 2
+
+/* queue element; a NULL buffer in filledBuffers ends the stream */
+typedef struct SegmentHandOff {
+  SegmentBuffer *buffer;
+} SegmentHandOff;
+
+/* Packets a worker writes to its chunk file, each followed by its data. */
+typedef struct ChunkPacketHeader {
+  int64_t pts;
+  int64_t dts;
+  int32_t size;
+  int32_t flags;
+} ChunkPacketHeader;
+
+/* A run of a worker's chunk and PCM chunk that is muxed as a whole: the
+ * entire chunks, with "checkpoint" or "progressive" one segment, or with
+ * "boomerang" one direction of one segment buffer, starting with a
+ * keyframe so the pieces can be muxed in any order. */
+typedef struct ChunkPiece {
+  struct ReverseWorker *worker;
+  /* the segment, -1 for a piece holding all of the worker's */
+  int segment;
+  int forward;
+  /* pts the encoder gave the first frame, and the frame count */
+  int64_t startPts;
+  int frames;
+  /* bytes of the chunk holding the packets */
+  off_t offset;
+  off_t end;
+  /* samples of the PCM chunk */
+  int64_t pcmOffset;
+  int64_t samples;
+} ChunkPiece;
+
+/* One worker reverses the contiguous run of segments
+ * [firstSegment, lastSegment] with its own demuxer, decoder and encoder,
+ * pipelined over its own pair of segment buffers, and writes the packets to
+ * its chunk file and the reversed audio to its PCM chunk. Chunks are
+ * concatenated last worker first, piece by piece, see orderPieces(). */
+typedef struct ReverseWorker {
+  ReverseContext *ctx;
+  int index;
+  int firstSegment;
+  int lastSegment;
+  AVFormatContext *formatContext_src;
+  AVStream *st_src;
+  AVFrame *frame_src;
+  AVCodecContext *codecContext_dst;
+  AVFrame *frame_dst;
+  struct SwsContext *fooContext;
+  /* source to store conversion when frame_pool_store() has no fast path */
+  struct SwsContext *storeContext;
+  /* direct rendering: the buffer whose pool the decoder renders into, NULL
+   * for libavcodec's own buffers, and how many slots beyond the segment
+   * the decoder may hold */
+  SegmentBuffer *renderBuffer;
+  int renderSlots;
+  /* frames kept where the decoder rendered them */
+  int renderedFrames;
+  int encodeFramePos;
+  /* with source timing, the output timestamp and duration of each frame
+   * encoded, by encodeFramePos */
+  FrameTiming *outTimings;
+  unsigned int outTimingsSize;
+  /* one segment of source packets when stream copying */
+  AVPacket *packets;
+  /* frames out of the decoder, stored or not */
+  int decodedFrames;
+  /* microseconds spent in each stage, see ReverseStats */
+  int64_t demuxTime;
+  int64_t decodeTime;
+  int64_t copyTime;
+  int64_t convertTime;
+  int64_t encodeTime;
+  int64_t audioTime;
+  FILE *chunk;
+  AudioReverse audio;
+  FILE *pcmChunk;
+  int64_t pcmSamples;
+  /* what the muxer reads the chunks through: the same files, or with
+   * "progressive" handles of its own, as it reads while the worker writes */
+  FILE *muxChunk;
+  FILE *muxPcmChunk;
+  /* pieces of the chunks in the order they were written; packets go to
+   * the piece under pieceCursor */
+  ChunkPiece *pieces;
+  int pieceCount;
+  int pieceCapacity;
+  int pieceCursor;
+  int forceKeyframe;
+  /* frames of the pieces restored from the checkpoint */
+  int resumedFrames;
+  /* "progressive": every piece the worker is to write has its place from
+   * the start, the first completedPieces of them are on disk and finished
+   * is set once the worker stops; both under the context's mutexPieces */
+  int plannedPieces;
+  int completedPieces;
+  int finished;
+  SegmentBuffer segmentBuffers[SEGMENT_BUFFER_COUNT];
+  Queue *freeBuffers;
+  Queue *filledBuffers;
+  pthread_mutex_t mutexHandOff;
+  pthread_cond_t condHandOff;
+  pthread_t thread;
+  int ret;
+} ReverseWorker;
+
+/* One reverse job. Everything a job needs lives here so that several jobs
+ * can run in one process; the fields below the options are read-only while
+ * the workers run. */
+struct ReverseContext {
+  char *srcPath;
+  char *dstPath;
+  AVDictionary *options;
+  /* set by reverse_context_cancel(), polled by every loop of the job and
+   * by the demuxers' interrupt callbacks */
+  pthread_mutex_t mutexCancel;
+  int cancelled;
+
+  /* frames per in-memory segment, from BUFFER_LIST_SIZE or the budget */
+  int segmentFrames;
+  /* bytes of deltas each buffer's frame cache holds */
+  size_t frameCacheSize;
+  int64_t memoryBudget;
+  const char *scratchPath;
+  /* "index_cache": directory of the sidecar packet indexes, NULL for none */
+  const char *indexCacheDir;
+  /* worker count forced by the "workers" option, 0 picks one per core */
+  int workerLimit;
+  /* requested range in microseconds from the start of the stream, <= 0
+   * leaves that side open */
+  int64_t rangeStartUs;
+  int64_t rangeEndUs;
+  /* encoder profile: "video_encoder", "bitrate", "preset", "threads",
+   * "lookahead", "gop", "qmin" and "qmax"; unset values are taken from the
+   * source stream or left to the encoder */
+  const char *videoEncoderName;
+  int bitRate;
+  const char *preset;
+  int encoderThreads;
+  int lookahead;
+  int gopSize;
+  int qmin;
+  int qmax;
+  /* "stream_copy": -1 copies intra-only streams, 0 never, 1 always */
+  int streamCopyOption;
+  /* "frame_cache": keep decoded frames as deltas, planning segments
+   * frameCacheRatio times longer than raw frames would allow */
+  int frameCache;
+  int frameCacheRatio;
+  /* "preview": longest side of a scaled down output, 0 keeps the size */
+  int previewSize;
+  /* "boomerang": the range forward, then reversed */
+  int boomerang;
+  /* "checkpoint": every segment is a piece of its own, recorded in the job
+   * manifest once it is on disk, so a job started again with the same
+   * arguments only does the segments that are missing */
+  int checkpoint;
+  JobManifest manifest;
+  /* "progressive": a fragmented MP4 muxed while the workers run, a
+   * fragment per piece reported to fragmentCallback; set only for
+   * containers the mov muxer writes */
+  int progressive;
+  ReverseFragmentCallback fragmentCallback;
+  void *fragmentOpaque;
+  pthread_mutex_t mutexPieces;
+  pthread_cond_t condPieces;
+  /* the fragment being written: its index, where it starts in the output
+   * and how many packets it holds yet */
+  int fragmentIndex;
+  int64_t fragmentOffset;
+  int fragmentPackets;
+  int64_t fragmentEnd;
+  /* microseconds the muxer waited for the workers */
+  int64_t pieceWaitTime;
+  /* a piece per segment, with boomerang, checkpoint or progressive */
+  int segmentPieces;
+  /* "direct_render": the decoders render into the frame pools, set only
+   * when the decoded pictures can be stored as they are */
+  int directRenderOption;
+  int directRender;
+  /* "decoder_threads" and "decoder_thread_type" of the workers' decoders;
+   * an automatic count splits the cores between the workers */
+  DecoderThreads decoderThreads;
+
+  AVFormatContext *formatContext_src;
+  AVFormatContext *formatContext_dst;
+  AVStream *st_src;
+  AVStream *st_dst;
+  AVCodec *codec_dst;
+  /* packets are reversed as they are, codec_dst is not used */
+  int streamCopy;
+  /* output frame rate, the encoders' time base is its inverse */
+  AVRational frameRate;
+  /* "timing": frames keep the source's timestamps, mirrored, instead of
+   * following each other at frameRate. Only set for containers that take
+   * variable frame rates; the muxer then gets the source time base */
+  int timingOption;
+  int sourceTiming;
+  /* display time of the range's first frame and of the frame after it */
+  int64_t rangeStartPts;
+  int64_t rangeEndPts;
+  int stream_index;
+  int frameCount;
+  /* size of the stored and encoded pictures; the decoders run at the
+   * source size shifted down by lowres */
+  int width, height;
+  int lowres;
+  /* audio: source stream (-1 for a silent output), the encoder and the
+   * packed PCM the workers prepare for it */
+  int audioStreamNo;
+  int audioStreamIndex;
+  AVStream *st_audio;
+  AVCodec *codec_audio;
+  enum AVSampleFormat audioSampleFmt;
+  int64_t audioChannelLayout;
+  int audioSampleRate;
+  int audioSampleSize;
+
+  PacketIndex packetIndex;
+  int hasDisplayOrder;
+  /* display positions of the first and last frame of the requested range */
+  int rangeStartPos;
+  int rangeEndPos;
+  ReverseSegment *segments;
+  int segmentCount;
+  ReverseWorker *workers;
+  int workerCount;
+  /* frames encoded by all workers per second of the worker phase */
+  int encodedFrames;
+  double encodeFps;
+  ReverseStats stats;
+};
+
+int isCancelled(ReverseContext *ctx) {
+  int cancelled;
+  pthread_mutex_lock(&ctx->mutexCancel);
+  cancelled = ctx->cancelled;
+  pthread_mutex_unlock(&ctx->mutexCancel);
+  return cancelled;
+}
+
+/* aborts blocking demuxer I/O once the job is cancelled */
+int interruptCallback(void *opaque) {
+  return isCancelled((ReverseContext*)opaque);
+}
+
+/* microseconds from the start of the video stream to its time base */
+int64_t rangeTimestamp(ReverseContext *ctx, int64_t positionUs) {
+  int64_t start = ctx->st_src->start_time != AV_NOPTS_VALUE
+                  ? ctx->st_src->start_time : 0;
+  if (positionUs <= 0) {
+    return AV_NOPTS_VALUE;
+  }
+  return start + av_rescale_q(positionUs, AV_TIME_BASE_Q,
+                              ctx->st_src->time_base);
+}
+
+/* Maps the requested range onto display positions of the index: frames
+ * shown at or after the start and before the end. */
+int findRange(ReverseContext *ctx) {
+  int64_t startTs = rangeTimestamp(ctx, ctx->rangeStartUs);
+  int64_t endTs = rangeTimestamp(ctx, ctx->rangeEndUs);
+  ctx->rangeStartPos = 0;
+  ctx->rangeEndPos = ctx->frameCount - 1;
+  if (startTs == AV_NOPTS_VALUE && endTs == AV_NOPTS_VALUE) {
+    return 0;
+  }
+  if (!ctx->hasDisplayOrder) {
+    LOGI(LOG_LEVEL, "Cannot trim a stream without timestamps\n");
+    return -1;
+  }
+  if (startTs != AV_NOPTS_VALUE) {
+    ctx->rangeStartPos = packet_index_display_pos(&ctx->packetIndex, startTs);
+  }
+  if (endTs != AV_NOPTS_VALUE) {
+    ctx->rangeEndPos = packet_index_display_pos(&ctx->packetIndex, endTs) - 1;
+  }
+  if (ctx->rangeStartPos > ctx->rangeEndPos) {
+    LOGI(LOG_LEVEL, "Empty range %"PRId64"-%"PRId64"us\n",
+         ctx->rangeStartUs, ctx->rangeEndUs);
+    return -1;
+  }
+  return 0;
+}
+
+/* display timestamp of frame pos; the frame after the last indexed one is
+ * shown when the last one's packet duration ends, later ones follow at the
+ * average frame duration */
+int64_t getFramePts(ReverseContext *ctx, int pos) {
+  int64_t last;
+  int64_t duration = 0;
+  if (pos < ctx->frameCount) {
+    return ctx->packetIndex.displayPts[pos];
+  }
+  last = ctx->packetIndex.displayPts[ctx->frameCount - 1];
+  if (ctx->frameCount > 1) {
+    duration = (last - ctx->packetIndex.displayPts[0]) / (ctx->frameCount - 1);
+  } else if (ctx->st_src->r_frame_rate.num) {
+    duration = av_rescale_q(1, av_inv_q(ctx->st_src->r_frame_rate),
+                            ctx->st_src->time_base);
+  }
+  if (ctx->packetIndex.lastDuration > 0 && ctx->packetIndex.lastPts == last) {
+    last += ctx->packetIndex.lastDuration;
+    pos--;
+  }
+  return last + duration * (pos - ctx->frameCount + 1);
+}
+
+/* Timing of the frame at display position pos shown at pts, the index's
+ * timestamp when it has none. It lasts until the next frame of the index,
+ * so the frames of a range add up to the span its audio is cut to. */
+FrameTiming getFrameTiming(ReverseContext *ctx, int pos, int64_t pts) {
+  FrameTiming timing;
+  timing.pts = pts != AV_NOPTS_VALUE ? pts : getFramePts(ctx, pos);
+  timing.duration = FFMAX(getFramePts(ctx, pos + 1) - timing.pts, 1);
+  return timing;
+}
+
+/* audio_stream_no if it is an audio stream, else the best one next to the
+ * video; none when the caller passed a negative number */
+int findAudioStream(ReverseContext *ctx) {
+  int index;
+  if (ctx->audioStreamNo < 0) {
+    return -1;
+  }
+  if (ctx->audioStreamNo < (int) ctx->formatContext_src->nb_streams &&
+      ctx->formatContext_src->streams[ctx->audioStreamNo]->codec->codec_type ==
+      AVMEDIA_TYPE_AUDIO) {
+    return ctx->audioStreamNo;
+  }
+  index = av_find_best_stream(ctx->formatContext_src, AVMEDIA_TYPE_AUDIO, -1,
+                              ctx->stream_index, NULL, 0);
+  return index >= 0 ? index : -1;
+}
+
+/* Indexes the packets of the range: sliced from the sidecar index when it
+ * holds the video stream's, else with a demux pass over the range alone.
+ * The index of a job on the whole file is kept in the sidecar for the next
+ * jobs on the source. */
+int buildPacketIndex(ReverseContext *ctx, const char* SRC_FILE) {
+  IndexCache cache;
+  int64_t startTs = rangeTimestamp(ctx, ctx->rangeStartUs);
+  int64_t endTs = rangeTimestamp(ctx, ctx->rangeEndUs);
+  int ret;
+  packet_index_init(&ctx->packetIndex);
+  index_cache_init(&cache);
+  if (ctx->indexCacheDir &&
+      index_cache_open(&cache, SRC_FILE, ctx->indexCacheDir) > 0 &&
+      cache.indexStream == ctx->stream_index) {
+    LOGI(LOG_LEVEL, "%d packets indexed in %s\n", cache.index.count,
+         cache.path);
+    ret = packet_index_slice(&ctx->packetIndex, &cache.index, startTs, endTs);
+  } else {
+    ret = packet_index_build_range(&ctx->packetIndex, ctx->formatContext_src,
+                                   ctx->stream_index, startTs, endTs);
+    if (ret >= 0 && !isCancelled(ctx) && cache.path &&
+        startTs == AV_NOPTS_VALUE && endTs == AV_NOPTS_VALUE &&
+        index_cache_save(&cache, ctx->stream_index, &ctx->packetIndex) < 0) {
+      LOGI(LOG_LEVEL, "Could not write index cache %s\n", cache.path);
+    }
   }
-  return pos;
+  index_cache_free(&cache);
+  return ret;
 }
 
-int initDecodeEnvironmentAndGetVideoFrameCount(const char* SRC_FILE) {
+int initDecodeEnvironmentAndGetVideoFrameCount(ReverseContext *ctx,
+                                              const char* SRC_FILE) {
+  int64_t start;
+  int ret;
   /* open input file, and allocated format context */
-  if (avformat_open_input(&formatContext_src, SRC_FILE, NULL, NULL) < 0) {
+  if (avformat_open_input(&ctx->formatContext_src, SRC_FILE, NULL, NULL) < 0) {
     LOGI(LOG_LEVEL, "Could not open source file %s\n", SRC_FILE);
     return -1;
   }
+  ctx->formatContext_src->interrupt_callback =
+      (AVIOInterruptCB) {interruptCallback, ctx};
   /* retrieve stream information */
-  if (avformat_find_stream_info(formatContext_src, NULL) < 0) {
+  /* an interrupted probe leaves the streams half described */
+  if (avformat_find_stream_info(ctx->formatContext_src, NULL) < 0 ||
+      isCancelled(ctx)) {
     LOGI(LOG_LEVEL, "Could not find stream information\n");
     return -1;
   }
   /* retrieve video stream index */
-  ret = av_find_best_stream(formatContext_src, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  ret = av_find_best_stream(ctx->formatContext_src, AVMEDIA_TYPE_VIDEO,
+                            -1, -1, NULL, 0);
   if (ret < 0) {
     LOGI(LOG_LEVEL, "Could not find video stream information\n");
     return -1;
   }
-  stream_index = ret;
+  ctx->stream_index = ret;
   /* retrieve video stream */
-  st_src = formatContext_src->streams[ret];
-  if (st_src == NULL) {
+  ctx->st_src = ctx->formatContext_src->streams[ret];
+  if (ctx->st_src == NULL) {
     LOGI(LOG_LEVEL, "video stream is NULL\n");
     return -1;
   }
   /* retrieve decodec context for video stream */
-  if (st_src->codec == NULL) {
+  if (ctx->st_src->codec == NULL) {
     LOGI(LOG_LEVEL, "decodec context is NULL\n");
     return -1;
   }
-  codec_src = avcodec_find_decoder(st_src->codec->codec_id);
-  if ((ret = avcodec_open2(st_src->codec, codec_src, NULL)) < 0) {
-    LOGI(LOG_LEVEL, "Failed to open %s codec\n",
-         av_get_media_type_string(st_src->codec->codec_id));
+  ctx->audioStreamIndex = findAudioStream(ctx);
+  /* count frames with a demux-only pass, decoding starts from a seek */
+  start = av_gettime();
+  ret = buildPacketIndex(ctx, SRC_FILE);
+  ctx->stats.demuxUs += av_gettime() - start;
+  if (ret < 0 || isCancelled(ctx)) {
+    LOGI(LOG_LEVEL, "Could not build packet index\n");
     return -1;
   }
+  ctx->frameCount = ctx->packetIndex.count;
+  ctx->hasDisplayOrder =
+      packet_index_build_display_order(&ctx->packetIndex) >= 0;
+  if (findRange(ctx) < 0) {
+    return -1;
+  }
+  LOGI(LOG_LEVEL, "initDecodeEnvironmentAndGetVideoFrameCount DONE[frameCount:%d keyframes:%d range:%d-%d]!\n",
+       ctx->frameCount, ctx->packetIndex.keyframeCount, ctx->rangeStartPos,
+       ctx->rangeEndPos);
+  return 0;
+}
+
+/* Direct rendering: the decoder gets a free slot of the buffer being
+ * filled and copyFrame2List() keeps the slot instead of copying the
+ * picture. Slots stay out of use while the decoder references them, so
+ * reference frames are never overwritten, and at most renderSlots of them
+ * are held by the decoder alone, so the segment always fits. Pictures that
+ * do not fit go to libavcodec's own buffers, laid out alike, and are
+ * copied as before. reget_buffer() keeps its default, which copies user
+ * buffers into a new one instead of writing to them. */
+int getFrameSlot(AVCodecContext *c, AVFrame *frame) {
+  ReverseWorker *worker = (ReverseWorker*)c->opaque;
+  SegmentBuffer *buffer = worker->renderBuffer;
+  int slot, i;
+  if (!buffer || c->pix_fmt != buffer->pool.pix_fmt ||
+      c->width != buffer->pool.width || c->height != buffer->pool.height ||
+      (slot = frame_pool_render(&buffer->pool, worker->renderSlots)) < 0) {
+    return avcodec_default_get_buffer(c, frame);
+  }
+  frame_pool_planes(&buffer->pool, slot, frame->data);
+  for (i = 0; i < 4; i++) {
+    frame->base[i] = frame->data[i];
+    frame->linesize[i] = buffer->pool.linesize[i];
+  }
+  frame->opaque = buffer;
+  frame->type = FF_BUFFER_TYPE_USER;
+  frame->extended_data = frame->data;
+  frame->pkt_pts = c->pkt ? c->pkt->pts : AV_NOPTS_VALUE;
+  frame->reordered_opaque = c->reordered_opaque;
+  frame->width = c->width;
+  frame->height = c->height;
+  frame->format = c->pix_fmt;
+  frame->sample_aspect_ratio = c->sample_aspect_ratio;
+  return 0;
+}
 
-  frame_src = avcodec_alloc_frame();
-  AVPacket pt_src;
-  int got_frame = -1;
-  frameCount = 0;
-  while (1) {
-    av_init_packet(&pt_src);
-    pt_src.data = NULL;
-    pt_src.size = 0;
-    if (av_read_frame(formatContext_src, &pt_src) < 0) {
-      break;
+/* called on the decoder thread too: frame threading defers the release of
+ * user buffers to the thread that feeds the decoder */
+void releaseFrameSlot(AVCodecContext *c, AVFrame *frame) {
+  SegmentBuffer *buffer = (SegmentBuffer*)frame->opaque;
+  int slot, i;
+  if (frame->type != FF_BUFFER_TYPE_USER) {
+    avcodec_default_release_buffer(c, frame);
+    return;
+  }
+  slot = frame_pool_slot_at(&buffer->pool, frame->data[0]);
+  if (slot >= 0) {
+    frame_pool_release(&buffer->pool, slot);
+  }
+  for (i = 0; i < 4; i++) {
+    frame->data[i] = NULL;
+  }
+}
+
+/* The strides avcodec_default_get_buffer() gives the decoder with
+ * CODEC_FLAG_EMU_EDGE, and the lines it writes: decoders refuse pictures
+ * whose stride differs from their earlier ones, so slots and libavcodec's
+ * buffers must be interchangeable. */
+void decoderPictureLayout(AVCodecContext *c, int linesize[4], int *height) {
+  int strideAlign[AV_NUM_DATA_POINTERS];
+  int width = c->width, unaligned, i;
+  *height = c->height;
+  avcodec_align_dimensions2(c, &width, height, strideAlign);
+  do {
+    av_image_fill_linesizes(linesize, c->pix_fmt, width);
+    /* the lowest bit set in width */
+    width += width & ~(width - 1);
+    unaligned = 0;
+    for (i = 0; i < 4; i++) {
+      unaligned |= linesize[i] % strideAlign[i];
     }
-    if (pt_src.stream_index == stream_index) {
-      ret = avcodec_decode_video2(st_src->codec, frame_src, &got_frame, &pt_src);
-      if (ret < 0) {
-        LOGI(LOG_LEVEL, "Error decoding video frame\n");
-        continue;
-      }
-      if (got_frame) {
-        frameCount++;
-      }
+  } while (unaligned);
+}
+
+/* Every worker demuxes and decodes on its own, so segments of the same
+ * file are read and decoded concurrently. */
+int initWorkerDecoder(ReverseWorker *worker, const char* SRC_FILE) {
+  ReverseContext *ctx = worker->ctx;
+  AVCodec *codec_src;
+  unsigned int i;
+  if (avformat_open_input(&worker->formatContext_src, SRC_FILE, NULL, NULL) < 0) {
+    LOGI(LOG_LEVEL, "Could not open source file %s\n", SRC_FILE);
+    return -1;
+  }
+  worker->formatContext_src->interrupt_callback =
+      (AVIOInterruptCB) {interruptCallback, ctx};
+  if (avformat_find_stream_info(worker->formatContext_src, NULL) < 0 ||
+      isCancelled(ctx) ||
+      ctx->stream_index >= worker->formatContext_src->nb_streams) {
+    LOGI(LOG_LEVEL, "Could not find stream information\n");
+    return -1;
+  }
+  worker->st_src = worker->formatContext_src->streams[ctx->stream_index];
+  /* audio is read through its own demuxer, skip it here */
+  for (i = 0; i < worker->formatContext_src->nb_streams; i++) {
+    if (i != (unsigned int) ctx->stream_index) {
+      worker->formatContext_src->streams[i]->discard = AVDISCARD_ALL;
     }
   }
-  LOGI(LOG_LEVEL, "initDecodeEnvironmentAndGetVideoFrameCount DONE[frameCount:%d]!\n", frameCount);
+  if (ctx->streamCopy) {
+    return 0;
+  }
+  codec_src = avcodec_find_decoder(worker->st_src->codec->codec_id);
+  worker->st_src->codec->lowres = ctx->lowres;
+  if (ctx->lowres) {
+    /* as in ffplay: motion vectors may point past the shrunken edges */
+    worker->st_src->codec->flags |= CODEC_FLAG_EMU_EDGE;
+  }
+  decoder_threads_apply(&ctx->decoderThreads, worker->st_src->codec,
+                        ctx->workerCount);
+  if (ctx->directRender) {
+    /* as in ffplay: slots have no room for edges */
+    worker->st_src->codec->flags |= CODEC_FLAG_EMU_EDGE;
+    worker->st_src->codec->get_buffer = getFrameSlot;
+    worker->st_src->codec->release_buffer = releaseFrameSlot;
+    worker->st_src->codec->opaque = worker;
+  }
+  if (avcodec_open2(worker->st_src->codec, codec_src, NULL) < 0) {
+    LOGI(LOG_LEVEL, "Failed to open %s codec\n",
+         av_get_media_type_string(worker->st_src->codec->codec_type));
+    return -1;
+  }
+  /* frames held back by frame threading come out of later packets and,
+   * at the end of the file, of the empty packets getYUVBufferList() sends;
+   * frame positions follow the frames, not the packets */
+  LOGI(LOG_LEVEL, "[worker %d] decoder threads: %d, frame delay %d\n",
+       worker->index, worker->st_src->codec->thread_count,
+       decoder_threads_delay(worker->st_src->codec));
+  /* the references, the reordering delay, the frame being decoded and
+   * one more in flight per frame thread */
+  worker->renderSlots = FFMAX(worker->st_src->codec->refs, 1) +
+                        worker->st_src->codec->has_b_frames + 1 +
+                        decoder_threads_delay(worker->st_src->codec);
+  worker->frame_src = avcodec_alloc_frame();
+  if (!worker->frame_src) {
+    LOGI(LOG_LEVEL, "Could not allocate video frame\n");
+    return -1;
+  }
   return 0;
 }
 
-void resetCodec() {
-  avcodec_close(st_src->codec);
-  if (avcodec_open2(st_src->codec, codec_src, NULL) < 0) {
-    LOGI(LOG_LEVEL, "[reset]Failed to open %s codec\n",
-         av_get_media_type_string(st_src->codec->codec_id));
+void seekSegment(ReverseWorker *worker, const ReverseSegment *segment) {
+  ReverseContext *ctx = worker->ctx;
+  if (!ctx->streamCopy) {
+    avcodec_flush_buffers(worker->st_src->codec);
+  }
+  if (av_seek_frame(worker->formatContext_src, ctx->stream_index,
+                    segment->seekTimestamp, AVSEEK_FLAG_BACKWARD) < 0) {
+    LOGI(LOG_LEVEL, "[seek]Failed to seek to %"PRId64"\n",
+         segment->seekTimestamp);
   }
-  av_seek_frame(formatContext_src, stream_index, 0, AVSEEK_FLAG_BACKWARD);
 }
 
-int initH263EncodeEnvironment(const char* OUT_FMT_FILE) {
+/* Picks the output format and its encoder. The stream is added by
+ * openOutput() once the workers' encoders have produced their headers. */
+int initH263EncodeEnvironment(ReverseContext *ctx, const char* OUT_FMT_FILE) {
   /* init AVFormatContext */
-  avformat_alloc_output_context2(&formatContext_dst, NULL, NULL, OUT_FMT_FILE);
-  if (!formatContext_dst) {
+  avformat_alloc_output_context2(&ctx->formatContext_dst, NULL, NULL,
+                                 OUT_FMT_FILE);
+  if (!ctx->formatContext_dst) {
     LOGI(LOG_LEVEL, "Could not deduce output format from file extension: using MPEG.\n");
-    avformat_alloc_output_context2(&formatContext_dst, NULL, "mpeg", OUT_FMT_FILE);
+    avformat_alloc_output_context2(&ctx->formatContext_dst, NULL, "mpeg",
+                                   OUT_FMT_FILE);
   }
-  if (!formatContext_dst) {
+  if (!ctx->formatContext_dst) {
     return -1;
   }
-  int codec_id = formatContext_dst->oformat->video_codec;
-  /* find the mpeg1 video encoder */
-  codec_dst = avcodec_find_encoder(codec_id);
-  if (!codec_dst) {
+  int codec_id = ctx->formatContext_dst->oformat->video_codec;
+  if (ctx->videoEncoderName) {
+    ctx->codec_dst = avcodec_find_encoder_by_name(ctx->videoEncoderName);
+    if (!ctx->codec_dst || ctx->codec_dst->type != AVMEDIA_TYPE_VIDEO ||
+        avformat_query_codec(ctx->formatContext_dst->oformat,
+                             ctx->codec_dst->id, FF_COMPLIANCE_NORMAL) == 0) {
+      LOGI(LOG_LEVEL, "Encoder %s not usable here, using the default\n",
+           ctx->videoEncoderName);
+      ctx->codec_dst = NULL;
+    }
+  }
+  /* find the container's default video encoder */
+  if (!ctx->codec_dst) {
+    ctx->codec_dst = avcodec_find_encoder(codec_id);
+  }
+  if (!ctx->codec_dst) {
       LOGI(LOG_LEVEL, "Codec not found\n");
       return -1;
   }
-  /* init AVStream */
-  st_dst = avformat_new_stream(formatContext_dst, codec_dst);
-  if (!st_dst) {
-    LOGI(LOG_LEVEL, "Could not allocate stream\n");
-    return -1;
+  return 0;
+}
+
+/* A preview keeps the aspect ratio with its longest side at previewSize
+ * and lets the decoder drop resolution with lowres where it can; the rest
+ * of the way is scaled with libyuv as frames are stored. */
+void choosePreviewSize(ReverseContext *ctx) {
+  int srcWidth = ctx->width;
+  int srcHeight = ctx->height;
+  int longest = FFMAX(srcWidth, srcHeight);
+  AVCodec *codec;
+  if (ctx->previewSize <= 0 || ctx->previewSize >= longest) {
+    return;
+  }
+  ctx->width = FFMAX((int) av_rescale(srcWidth, ctx->previewSize, longest) & ~1,
+                     2);
+  ctx->height = FFMAX((int) av_rescale(srcHeight, ctx->previewSize, longest) & ~1,
+                      2);
+  codec = avcodec_find_decoder(ctx->st_src->codec->codec_id);
+  while (codec && ctx->lowres < codec->max_lowres &&
+         srcWidth >> (ctx->lowres + 1) >= ctx->width &&
+         srcHeight >> (ctx->lowres + 1) >= ctx->height) {
+    ctx->lowres++;
+  }
+  LOGI(LOG_LEVEL, "preview %dx%d from %dx%d, decoder lowres %d\n",
+       ctx->width, ctx->height, srcWidth, srcHeight, ctx->lowres);
+}
+
+/* When every frame is a keyframe the stream is reversed by writing its
+ * packets backwards, nothing is decoded or encoded. Asking for a specific
+ * encoder or bit rate keeps the transcode. */
+int canStreamCopy(ReverseContext *ctx) {
+  int query;
+  if (ctx->streamCopyOption == 0 || !ctx->hasDisplayOrder ||
+      ctx->width != ctx->st_src->codec->width ||
+      ctx->height != ctx->st_src->codec->height) {
+    return 0;
+  }
+  if (ctx->streamCopyOption < 0 &&
+      (ctx->videoEncoderName || ctx->bitRate > 0 ||
+       ctx->packetIndex.keyframeCount < ctx->packetIndex.count)) {
+    return 0;
+  }
+  query = avformat_query_codec(ctx->formatContext_dst->oformat,
+                               ctx->st_src->codec->codec_id,
+                               FF_COMPLIANCE_NORMAL);
+  if (query == 0) {
+    LOGI(LOG_LEVEL, "%s cannot be copied into %s\n",
+         avcodec_get_name(ctx->st_src->codec->codec_id),
+         ctx->formatContext_dst->oformat->name);
+    return 0;
+  }
+  return 1;
+}
+
+/* the decoded frames' format when the encoder takes it, else its first */
+enum PixelFormat choosePixelFormat(const AVCodec *codec) {
+  const enum PixelFormat *fmt;
+  if (!codec->pix_fmts) {
+    return STREAM_PIX_FMT;
+  }
+  for (fmt = codec->pix_fmts; *fmt != PIX_FMT_NONE; fmt++) {
+    if (*fmt == STREAM_PIX_FMT) {
+      return *fmt;
+    }
+  }
+  return codec->pix_fmts[0];
+}
+
+/* The source frame rate, snapped to the encoder's list when it only takes
+ * some, with a denominator small enough for MPEG-4 time bases. */
+AVRational chooseFrameRate(ReverseContext *ctx) {
+  AVRational rate = ctx->st_src->r_frame_rate;
+  const AVRational *supported = ctx->codec_dst ? ctx->codec_dst->supported_framerates
+                                               : NULL;
+  if (rate.num <= 0 || rate.den <= 0) {
+    rate = ctx->st_src->avg_frame_rate;
+  }
+  if (rate.num <= 0 || rate.den <= 0) {
+    rate = (AVRational) {STREAM_FRAME_RATE, 1};
+  }
+  if (supported && !ctx->streamCopy) {
+    rate = supported[av_find_nearest_q_idx(rate, supported)];
+  }
+  av_reduce(&rate.num, &rate.den, rate.num, rate.den, 65535);
+  return rate;
+}
+
+/* Muxers storing a timestamp or duration per frame. mov and mp4 do, though
+ * this FFmpeg does not flag them AVFMT_VARIABLE_FPS; AVI does not, whatever
+ * its flag says, it pads gaps with empty frames. */
+static const char *const variableFpsFormats[] = {
+  "mov", "mp4", "3gp", "3g2", "ipod", "psp", "ismv", "f4v",
+  "matroska", "webm", "flv", "nut", NULL
+};
+
+/* muxers of libavformat's movenc.c, which can write fragments */
+static const char *const fragmentFormats[] = {
+  "mov", "mp4", "3gp", "3g2", "ipod", "psp", "ismv", "f4v", NULL
+};
+
+int isOutputFormat(ReverseContext *ctx, const char *const *names) {
+  const char *name = ctx->formatContext_dst->oformat->name;
+  int i;
+  for (i = 0; names[i]; i++) {
+    if (!strcmp(name, names[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Frames keep their timestamps when each one has its own and the container
+ * stores them as they come; the others get the constant frame rate. */
+int useSourceTiming(ReverseContext *ctx) {
+  if (!ctx->timingOption || !ctx->hasDisplayOrder || ctx->frameCount <= 0) {
+    return 0;
+  }
+  return isOutputFormat(ctx, variableFpsFormats);
+}
+
+int useProgressiveOutput(ReverseContext *ctx) {
+  if (!ctx->progressive) {
+    return 0;
+  }
+  if (!isOutputFormat(ctx, fragmentFormats)) {
+    LOGI(LOG_LEVEL, "progressive output needs MP4, MOV or 3GP, ignored\n");
+    return 0;
+  }
+  return 1;
+}
+
+/* The decoders render into the frame pools when their pictures are stored
+ * unchanged: 8-bit 4:2:0 at the store size, by a codec that supports
+ * custom buffers. The frame cache keeps only two raw slots, it copies. */
+int canRenderDirect(ReverseContext *ctx) {
+  AVCodecContext *c = ctx->st_src->codec;
+  AVCodec *codec = avcodec_find_decoder(c->codec_id);
+  if (!ctx->directRenderOption || ctx->streamCopy || ctx->frameCache ||
+      !codec || !(codec->capabilities & CODEC_CAP_DR1)) {
+    return 0;
+  }
+  return c->pix_fmt == STREAM_PIX_FMT && ctx->lowres == 0 &&
+         c->width == ctx->width && c->height == ctx->height;
+}
+
+int isSampleRateSupported(const AVCodec *codec, int sample_rate) {
+  const int *rate = codec->supported_samplerates;
+  if (!rate) {
+    return 1;
+  }
+  for (; *rate; rate++) {
+    if (*rate == sample_rate) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Picks the audio encoder, AAC (through vo-aacenc when it is built in)
+ * where the container takes it, else the container's default, and the
+ * packed PCM format the workers convert to. Without a usable encoder the
+ * output stays silent. */
+int initAudioEncodeEnvironment(ReverseContext *ctx) {
+  AVOutputFormat *oformat = ctx->formatContext_dst->oformat;
+  AVCodecContext *src;
+  const enum AVSampleFormat *fmt;
+  int codec_id = oformat->audio_codec;
+  ctx->codec_audio = NULL;
+  ctx->audioSampleFmt = AV_SAMPLE_FMT_NONE;
+  if (ctx->audioStreamIndex < 0) {
+    return 0;
+  }
+  if (!ctx->hasDisplayOrder) {
+    LOGI(LOG_LEVEL, "No video timestamps to align the audio with, output is silent\n");
+    ctx->audioStreamIndex = -1;
+    return 0;
+  }
+  if (avformat_query_codec(oformat, AV_CODEC_ID_AAC, FF_COMPLIANCE_NORMAL) == 1) {
+    codec_id = AV_CODEC_ID_AAC;
+    ctx->codec_audio = avcodec_find_encoder_by_name("libvo_aacenc");
+  }
+  if (!ctx->codec_audio && codec_id != AV_CODEC_ID_NONE) {
+    ctx->codec_audio = avcodec_find_encoder(codec_id);
+  }
+  src = ctx->formatContext_src->streams[ctx->audioStreamIndex]->codec;
+  for (fmt = ctx->codec_audio ? ctx->codec_audio->sample_fmts : NULL;
+       fmt && *fmt != AV_SAMPLE_FMT_NONE; fmt++) {
+    if (!av_sample_fmt_is_planar(*fmt)) {
+      ctx->audioSampleFmt = *fmt;
+      break;
+    }
+  }
+  if (ctx->audioSampleFmt == AV_SAMPLE_FMT_NONE || src->channels <= 0 ||
+      !isSampleRateSupported(ctx->codec_audio, src->sample_rate)) {
+    LOGI(LOG_LEVEL, "No audio encoder for %d Hz, output is silent\n",
+         src->sample_rate);
+    ctx->audioStreamIndex = -1;
+    return 0;
+  }
+  ctx->audioSampleRate = src->sample_rate;
+  ctx->audioChannelLayout =
+      av_get_default_channel_layout(FFMIN(src->channels, 2));
+  ctx->audioSampleSize = FFMIN(src->channels, 2) *
+                         av_get_bytes_per_sample(ctx->audioSampleFmt);
+  LOGI(LOG_LEVEL, "audio stream %d: %s, %d Hz, %s\n", ctx->audioStreamIndex,
+       ctx->codec_audio->name, ctx->audioSampleRate,
+       av_get_sample_fmt_name(ctx->audioSampleFmt));
+  return 0;
+}
+
+/* Workers get identically configured encoders, so their chunks share one
+ * set of codec headers and concatenate into a single stream. */
+/* Every piece starts on a forced keyframe, so the GOP only sets the
+ * keyframes within a segment: as many as the source had, or none for a
+ * source made only of keyframes, whose GOP would make the output all
+ * intra. */
+int chooseGopSize(ReverseContext *ctx) {
+  int longest = 1, gop, i;
+  if (ctx->gopSize > 0) {
+    return ctx->gopSize;
   }
-  st_dst->id = stream_index;
-  if (formatContext_dst->oformat->flags & AVFMT_GLOBALHEADER) {
-    st_dst->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+  for (i = 0; i < ctx->segmentCount; i++) {
+    longest = FFMAX(longest, ctx->segments[i].endFramePos -
+                             ctx->segments[i].startFramePos + 1);
+  }
+  gop = ctx->frameCount / FFMAX(ctx->packetIndex.keyframeCount, 1);
+  return gop > 1 ? FFMIN(gop, longest) : longest;
+}
+
+int initWorkerEncoder(ReverseWorker *worker) {
+  ReverseContext *ctx = worker->ctx;
+  AVCodecContext *c = avcodec_alloc_context3(ctx->codec_dst);
+  AVDictionary *opts = NULL;
+  AVDictionaryEntry *unused = NULL;
+  int err;
+  if (!c) {
+    LOGI(LOG_LEVEL, "Could not allocate encoder context\n");
+    return -1;
   }
-  /* init AVCodecContext */
-  avcodec_get_context_defaults3(st_dst->codec, codec_dst);
+  worker->codecContext_dst = c;
   {
     /* init AVCodecContext for open */
-    st_dst->codec->codec_id = codec_id;
+    c->codec_id = ctx->codec_dst->id;
     /* Put sample parameters. */
-    st_dst->codec->codec_type = AVMEDIA_TYPE_VIDEO;
-    st_dst->codec->bit_rate = 400000;//codecContext->bit_rate;
+    c->codec_type = AVMEDIA_TYPE_VIDEO;
+    c->bit_rate = ctx->bitRate > 0 ? ctx->bitRate
+                  : ctx->st_src->codec->bit_rate > 0 ? ctx->st_src->codec->bit_rate
+                  : 400000;
+    if (ctx->bitRate <= 0 && ctx->width != ctx->st_src->codec->width) {
+      /* a preview gets the source's bits per pixel */
+      c->bit_rate = (int) FFMAX(av_rescale(c->bit_rate,
+                                           ctx->width * ctx->height,
+                                           ctx->st_src->codec->width *
+                                           ctx->st_src->codec->height),
+                                50000);
+    }
     /* Resolution must be a multiple of two. */
-    st_dst->codec->width    = width;
-    st_dst->codec->height   = height;
+    c->width    = ctx->width;
+    c->height   = ctx->height;
     /* timebase: This is the fundamental unit of time (in seconds) in terms
      * of which frame timestamps are represented. For fixed-fps content,
      * timebase should be 1/framerate and timestamp increments should be
      * identical to 1. */
-    st_dst->codec->time_base.den = 25;//STREAM_FRAME_RATE;//st_src->codec->time_base.den;
-    st_dst->codec->time_base.num = 1;//st_src->codec->time_base.num;
-    st_dst->codec->gop_size      = 12;//st_src->codec->gop_size;
-    st_dst->codec->pix_fmt       = PIX_FMT_YUV420P;//st_src->codec->pix_fmt;
-    st_dst->codec->qmin          = 10;//st_src->codec->qmin;
-    st_dst->codec->qmax          = 51;//st_src->codec->qmax;
-    if (st_dst->codec->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
+    c->time_base = av_inv_q(ctx->frameRate);
+    c->gop_size      = chooseGopSize(ctx);
+    c->pix_fmt       = choosePixelFormat(ctx->codec_dst);
+    /* the quantizer range is the encoder's own unless asked for */
+    if (ctx->qmin >= 0) {
+      c->qmin = ctx->qmin;
+    }
+    if (ctx->qmax >= 0) {
+      c->qmax = ctx->qmax;
+    }
+    if (c->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
         /* just for testing, we also add B frames */
-        st_dst->codec->max_b_frames = 2;
+        c->max_b_frames = 2;
     }
-    if (st_dst->codec->codec_id == AV_CODEC_ID_MPEG1VIDEO) {
+    if (c->codec_id == AV_CODEC_ID_MPEG1VIDEO) {
         /* Needed to avoid using macroblocks in which some coeffs overflow.
          * This does not happen with normal video, it just happens here as
          * the motion of the chroma plane does not match the luma plane. */
-        st_dst->codec->mb_decision = 2;
+        c->mb_decision = 2;
+    }
+    if (ctx->formatContext_dst->oformat->flags & AVFMT_GLOBALHEADER) {
+      c->flags |= CODEC_FLAG_GLOBAL_HEADER;
     }
-    if (formatContext_dst->oformat->flags & AVFMT_GLOBALHEADER) {
-      st_dst->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+    if (ctx->encoderThreads > 0) {
+      c->thread_count = ctx->encoderThreads;
     }
   }
+  /* private options, encoders without them leave them in opts */
+  if (ctx->preset) {
+    av_dict_set(&opts, "preset", ctx->preset, 0);
+  }
+  if (ctx->lookahead >= 0) {
+    char lookahead[16];
+    snprintf(lookahead, sizeof(lookahead), "%d", ctx->lookahead);
+    av_dict_set(&opts, "rc-lookahead", lookahead, 0);
+  }
   /* open it */
-  if (avcodec_open2(st_dst->codec, codec_dst, NULL) < 0) {
-      LOGI(LOG_LEVEL, "Could not open codec\n");
-      return -1;
+  err = avcodec_open2(c, ctx->codec_dst, &opts);
+  while ((unused = av_dict_get(opts, "", unused, AV_DICT_IGNORE_SUFFIX))) {
+    LOGI(LOG_LEVEL, "%s ignores option %s\n", ctx->codec_dst->name,
+         unused->key);
   }
-  /* open the output file, if needed */
-  if (!(formatContext_dst->oformat->flags & AVFMT_NOFILE)) {
-    if (avio_open(&formatContext_dst->pb, OUT_FMT_FILE, AVIO_FLAG_WRITE) < 0) {
-      LOGI(LOG_LEVEL, "[output]Could not open '%s'\n", OUT_FMT_FILE);
+  av_dict_free(&opts);
+  if (err < 0) {
+      LOGI(LOG_LEVEL, "Could not open codec\n");
       return -1;
-    }
-  }
-  /* Write the stream header, if any. */
-  if (avformat_write_header(formatContext_dst, NULL) < 0) {
-    LOGI(LOG_LEVEL, "[output]Error occurred when opening output file\n");
-    return -1;
   }
   return 0;
 }
 
-int initReuseBuffer() {
+/* Stored frames go to the encoder as they are, frame_dst only points at
+ * the pool planes. A picture and a conversion context are set up only when
+ * the encoder wants another pixel format or size. */
+int initReuseBuffer(ReverseWorker *worker) {
+  ReverseContext *ctx = worker->ctx;
+  AVCodecContext *c = worker->codecContext_dst;
   AVPicture picture_pic;
-  frame_dst = avcodec_alloc_frame();
-  if (!frame_dst) {
+  worker->frame_dst = avcodec_alloc_frame();
+  if (!worker->frame_dst) {
       LOGI(LOG_LEVEL, "Could not allocate video frame\n");
       return -1;
   }
-  if (avpicture_alloc(&picture_pic, st_dst->codec->pix_fmt,
-                      width, height) < 0) {
+  if (c->pix_fmt == STREAM_PIX_FMT &&
+      c->width == ctx->width && c->height == ctx->height) {
+    return 0;
+  }
+  if (avpicture_alloc(&picture_pic, c->pix_fmt, c->width, c->height) < 0) {
     LOGI(LOG_LEVEL, "Could not allocate video picture\n");
     return -1;
   }
-  if (st_dst->codec->pix_fmt != PIX_FMT_YUV420P) {
-    LOGI(LOG_LEVEL, "pix_fmt: %d\n", st_dst->codec->pix_fmt);
-    ret = avpicture_alloc(&picture_pic, PIX_FMT_YUV420P,
-                          width, height);
-    if (ret < 0) {
-      LOGI(LOG_LEVEL, "Could not allocate temporary picture\n");
-      return -1;
-    }
-  }
   /* copy data and linesize picture pointers to frame */
-  *((AVPicture *)frame_dst) = picture_pic;
-  fooContext = sws_getContext(width, height, PIX_FMT_YUV420P,
-                              width, height, PIX_FMT_YUV420P,
-                              SWS_BICUBIC, NULL, NULL, NULL);
+  *((AVPicture *)worker->frame_dst) = picture_pic;
+  worker->fooContext = sws_getContext(ctx->width, ctx->height, STREAM_PIX_FMT,
+                                      c->width, c->height, c->pix_fmt,
+                                      SWS_BICUBIC, NULL, NULL, NULL);
+  if (!worker->fooContext) {
+    LOGI(LOG_LEVEL, "Could not initialize the conversion context\n");
+    return -1;
+  }
+  LOGI(LOG_LEVEL, "[worker %d] converting %dx%d %s to %dx%d %s\n",
+       worker->index, ctx->width, ctx->height,
+       av_get_pix_fmt_name(STREAM_PIX_FMT), c->width, c->height,
+       av_get_pix_fmt_name(c->pix_fmt));
   return 0;
 }
 
-void copyFrame2List() {
-  YUVBufferList* pItem = (YUVBufferList*)av_malloc(sizeof(YUVBufferList));
-  int widthMultiHeight = width * height;
-  pItem->data[0] = (uint8_t*)malloc(widthMultiHeight);
-  pItem->data[1] = (uint8_t*)malloc(widthMultiHeight >> 2);
-  pItem->data[2] = (uint8_t*)malloc(widthMultiHeight >> 2);
-  pItem->data[3] = 0;
-  memset(pItem->data[0], 0, widthMultiHeight);
-  memset(pItem->data[1], 0, widthMultiHeight >> 2);
-  memset(pItem->data[2], 0, widthMultiHeight >> 2);
-  CopyYuv(frame_src->data[0], frame_src->linesize[0],
-    width, height, pItem->data[0]);
-  CopyYuv(frame_src->data[1], frame_src->linesize[1],
-    width / 2, height / 2, pItem->data[1]);
-  CopyYuv(frame_src->data[2], frame_src->linesize[2],
-    width / 2, height / 2, pItem->data[2]);
-  pItem->next = (void*)pHeader;
-  pHeader = pItem;
+/* One worker per core, but only as many as can keep a GOP in each of their
+ * buffers within the memory budget, and never more than there are GOPs.
+ * The "workers" option overrides the core count and the budget check.
+ * The plan of a resumable job is in its manifest header, so it counts the
+ * cores configured rather than those online, which hotplug and thermal
+ * limits change between a kill and the restart. */
+int chooseWorkerCount(ReverseContext *ctx, size_t slotSize) {
+  long cores = sysconf(ctx->checkpoint ? _SC_NPROCESSORS_CONF
+                                       : _SC_NPROCESSORS_ONLN);
+  int count = ctx->workerLimit > 0 ? ctx->workerLimit : (int) FFMAX(cores, 1);
+  if (!ctx->hasDisplayOrder) {
+    /* every segment would decode from the start of the file */
+    return 1;
+  }
+  if (ctx->workerLimit <= 0) {
+    int gopFrames = ctx->frameCount / FFMAX(ctx->packetIndex.keyframeCount, 1);
+    int64_t budget = ctx->memoryBudget > 0 ? ctx->memoryBudget
+                                      : (int64_t) BUFFER_LIST_SIZE * slotSize;
+    int64_t perWorker = (int64_t) SEGMENT_BUFFER_COUNT * FFMAX(gopFrames, 1) *
+                        slotSize;
+    count = (int) FFMIN(count, FFMAX(budget / perWorker, 1));
+  }
+  return FFMAX(1, FFMIN(count, ctx->packetIndex.keyframeCount));
 }
 
-int freeAVPacketItem(YUVBufferList* pItem) {
-  if (pItem) {
-    av_free(pItem->data[0]);
-    av_free(pItem->data[1]);
-    av_free(pItem->data[2]);
-    av_free(pItem);
+/* Without a budget all buffers of all workers share BUFFER_LIST_SIZE
+ * frames. With one, each buffer gets an equal part, split between its pool
+ * and the mapped window of its spill file (an eighth), so RSS stays bounded
+ * whatever the resolution. Returns the spill window in frames. */
+int computeSegmentFrames(ReverseContext *ctx, size_t slotSize) {
+  int buffers = ctx->workerCount * SEGMENT_BUFFER_COUNT;
+  int spillWindow = 0;
+  ctx->segmentFrames = FFMAX(1, BUFFER_LIST_SIZE / buffers);
+  if (ctx->memoryBudget > 0) {
+    int slots = (int) FFMIN(ctx->memoryBudget / buffers / slotSize, INT_MAX);
+    spillWindow = FFMAX(1, slots / 8);
+    ctx->segmentFrames = FFMAX(1, slots - spillWindow);
   }
-  return 0;
+  if (ctx->frameCache) {
+    /* the newest frame and the one being decoded stay raw, the rest of
+     * the share holds deltas; the cache takes the place of the spill file */
+    int slots = ctx->memoryBudget > 0
+        ? (int) FFMIN(ctx->memoryBudget / buffers / slotSize, INT_MAX)
+        : ctx->segmentFrames;
+    ctx->frameCacheSize = (size_t) FFMAX(slots - 2, 1) * slotSize;
+    ctx->segmentFrames = (int) FFMIN((int64_t) FFMAX(slots, 1) *
+                                     ctx->frameCacheRatio, INT_MAX / 2);
+    spillWindow = 0;
+  }
+  LOGI(LOG_LEVEL, "computeSegmentFrames: %d workers x %d x %d frames of %zu bytes, spill window %d\n",
+       ctx->workerCount, SEGMENT_BUFFER_COUNT, ctx->segmentFrames, slotSize,
+       spillWindow);
+  return spillWindow;
 }
 
-int encodeYUVBufferList() {
-  YUVBufferList* pItem = NULL;
-  AVPacket pkt;
-  int linesize[4] = {width, width / 2, width / 2, 0};
-  int got_output = -1;
-  while (pHeader) {
-    pItem = pHeader;
-    pHeader = pItem->next;
-    av_init_packet(&pkt);
-    pkt.data = NULL;
-    pkt.size = 0;
-    sws_scale(fooContext, pItem->data, linesize,
-              0, height,
-              frame_dst->data, frame_dst->linesize);
-    freeAVPacketItem(pItem);
-    frame_dst->pts = encodeFramePos;
-    /* encode the image */
-    ret = avcodec_encode_video2(st_dst->codec, &pkt, frame_dst, &got_output);
-    if (ret < 0) {
-        LOGI(LOG_LEVEL, "Error encoding frame\n");
-        continue;
+int initSegmentBuffers(ReverseWorker *worker) {
+  ReverseContext *ctx = worker->ctx;
+  int i, j, err;
+  for (i = 0; i < SEGMENT_BUFFER_COUNT; i++) {
+    SegmentBuffer *buffer = &worker->segmentBuffers[i];
+    if (ctx->frameCache) {
+      if (frame_pool_init(&buffer->pool, 2, ctx->width, ctx->height,
+                          STREAM_PIX_FMT) < 0 ||
+          frame_cache_init(&buffer->cache, ctx->frameCacheSize,
+                           buffer->pool.slotSize, ctx->segmentFrames) < 0) {
+        LOGI(LOG_LEVEL, "Could not allocate frame cache\n");
+        return -1;
+      }
+      /* the line padding is never written, keep it out of the deltas */
+      memset(buffer->pool.slab, 0, 2 * buffer->pool.slotSize);
+      continue;
     }
-    if (got_output) {
-      LOGI(LOG_LEVEL, "Encoding to video...[%d]", encodeFramePos);
-//      if (st_dst->codec->coded_frame->pts != AV_NOPTS_VALUE) {
-//        pkt.pts = av_rescale_q(st_dst->codec->coded_frame->pts,
-//                               st_dst->codec->time_base,
-//                               st_dst->time_base);
-//      }
-      /* Write the compressed frame to the media file. */
-      pkt.stream_index = stream_index;
-      ret = av_interleaved_write_frame(formatContext_dst, &pkt);
-      if (ret < 0) {
-        LOGI(LOG_LEVEL, "[output] write frame failed: %d \n", ret);
-      } else {
-        encodeFramePos++;
+    if (ctx->directRender) {
+      /* the render slots take the place of the decoder's own buffers */
+      int linesize[4], height;
+      decoderPictureLayout(worker->st_src->codec, linesize, &height);
+      err = frame_pool_init_layout(&buffer->pool,
+                                   ctx->segmentFrames + worker->renderSlots,
+                                   ctx->width, ctx->height, linesize, height,
+                                   STREAM_PIX_FMT);
+      if (err == 0) {
+        /* as avcodec_default_get_buffer(): some decoders leave parts of
+         * the picture as they found them */
+        memset(buffer->pool.slab, 128,
+               buffer->pool.slotSize * buffer->pool.capacity);
       }
+    } else {
+      err = frame_pool_init(&buffer->pool, ctx->segmentFrames, ctx->width,
+                            ctx->height, STREAM_PIX_FMT);
+    }
+    if (err < 0) {
+      LOGI(LOG_LEVEL, "Could not allocate frame pool\n");
+      return -1;
+    }
+    buffer->nodes = (YUVBufferList*)av_mallocz(buffer->pool.capacity *
+                                               sizeof(YUVBufferList));
+    if (!buffer->nodes) {
+      LOGI(LOG_LEVEL, "Could not allocate buffer list\n");
+      return -1;
+    }
+    for (j = 0; j < buffer->pool.capacity; j++) {
+      frame_pool_planes(&buffer->pool, j, buffer->nodes[j].data);
     }
   }
+  if (ctx->directRender) {
+    LOGI(LOG_LEVEL, "[worker %d] direct rendering, %d slots for the decoder\n",
+         worker->index, worker->renderSlots);
+  }
+  return 0;
 }
 
-YUVBufferList* getYUVBufferList(int startFramePos, int endFramePos) {
-  int framePos = 0;
-  AVPacket pt_src;
-  LOGI(LOG_LEVEL, "start pos: %d, end pos: %d\n", startFramePos, endFramePos);
-  pHeader = NULL;
-  while (framePos <= endFramePos) {
-    av_init_packet(&pt_src);
-    pt_src.data = NULL;
-    pt_src.size = 0;
-    if (av_read_frame(formatContext_src, &pt_src) < 0) {
-      LOGI(LOG_LEVEL, "No frame to read. frameCount:%d\n", framePos);
-      break;
+char *scratchFilePath(ReverseContext *ctx, const char* OUT_FMT_FILE,
+                      const char *kind, int n) {
+  return ctx->scratchPath ? av_asprintf("%s.%s%d", ctx->scratchPath, kind, n)
+                     : av_asprintf("%s.%s%d", OUT_FMT_FILE, kind, n);
+}
+
+int openSpillFiles(ReverseWorker *worker, const char* OUT_FMT_FILE,
+                   int spillWindow) {
+  ReverseContext *ctx = worker->ctx;
+  int i;
+  for (i = 0; i < SEGMENT_BUFFER_COUNT; i++) {
+    SegmentBuffer *buffer = &worker->segmentBuffers[i];
+    char *path = scratchFilePath(ctx, OUT_FMT_FILE,
+                                 ctx->scratchPath ? "" : "scratch",
+                                 worker->index * SEGMENT_BUFFER_COUNT + i);
+    int err = -1;
+    if (path) {
+      err = spill_file_open(&buffer->spill, path, buffer->pool.slotSize,
+                            spillWindow);
+      av_free(path);
     }
-    if (pt_src.stream_index == stream_index) {
-      avcodec_decode_video2(st_src->codec, frame_src, &got_frame, &pt_src);
-      if (got_frame) {
-        framePos++;
-        if (framePos > endFramePos) {
-          break;
-        } else if (framePos >= startFramePos) {
-          LOGI(LOG_LEVEL, "video_frame n:%d coded_n:%d pts:%s\n",
-               framePos, frame_src->coded_picture_number,
-               av_ts2timestr(frame_src->pts, &st_src->codec->time_base));
-          copyFrame2List();
-        }
-      }
+    if (err < 0) {
+      LOGI(LOG_LEVEL, "Could not open spill file: %s\n", strerror(errno));
+      return -1;
     }
   }
-  return pHeader;
-}
-
-int writeTrailer() {
-  av_write_trailer(formatContext_dst);
-  LOGI(LOG_LEVEL, "Encoding video frame DONE!\n");
   return 0;
 }
 
-int decode2YUV2Video(const char* SRC_FILE, const char* OUT_FMT_FILE) {
-  ret = initDecodeEnvironmentAndGetVideoFrameCount(SRC_FILE);
-  if (ret < 0) {
-    LOGI(LOG_LEVEL, "initDecodeEnvironmentAndGetVideoFrameCount error.\n");
-    goto end;
+/* chunks are unlinked right away, they only live until the job ends;
+ * with checkpoints they stay until it is done and are reopened as they
+ * are, resumeJob() cuts them back to what the manifest records. *muxChunk
+ * is what the muxer reads the chunk through. */
+FILE *openChunkFile(ReverseWorker *worker, const char* OUT_FMT_FILE,
+                    const char *kind, FILE **muxChunk) {
+  FILE *chunk = NULL;
+  char *path = scratchFilePath(worker->ctx, OUT_FMT_FILE, kind, worker->index);
+  if (!path) {
+    return NULL;
   }
-  if (frameCount <= 0) {
-    goto end;
+  if (worker->ctx->checkpoint) {
+    chunk = fopen(path, "r+b");
   }
-  width = st_src->codec->width;
-  height = st_src->codec->height;
-  
-  //initYUVEncodeEnvironment();
-  ret = initH263EncodeEnvironment(OUT_FMT_FILE);
-  if (ret < 0) {
-    LOGI(LOG_LEVEL, "initH263EncodeEnvironment error.\n");
-    goto end;
+  if (!chunk) {
+    chunk = fopen(path, "w+b");
   }
-  // initReuseBuffer must be after initH263EncodeEnvironment
-  ret = initReuseBuffer();
-  if (ret < 0) {
-    LOGI(LOG_LEVEL, "initReuseBuffer error.\n");
-    goto end;
+  *muxChunk = chunk;
+  if (chunk && worker->ctx->progressive &&
+      !(*muxChunk = fopen(path, "rb"))) {
+    fclose(chunk);
+    chunk = NULL;
   }
-  int loopTimes = (int) (frameCount / BUFFER_LIST_SIZE);
-  int i, encodeFramePos = 0;
-  YUVBufferList *pktListHeader = NULL;
+  if (chunk && !worker->ctx->checkpoint) {
+    unlink(path);
+  } else if (!chunk) {
+    LOGI(LOG_LEVEL, "Could not open chunk file %s: %s\n", path, strerror(errno));
+  }
+  av_free(path);
+  return chunk;
+}
 
-  for (i = loopTimes; i >= 0; i--) {
-    int startFramePos = BUFFER_LIST_SIZE * i;
-    int endFramePos = startFramePos + BUFFER_LIST_SIZE - 1;
+void freeSegmentBuffers(ReverseWorker *worker) {
+  int i;
+  for (i = 0; i < SEGMENT_BUFFER_COUNT; i++) {
+    frame_pool_free(&worker->segmentBuffers[i].pool);
+    av_freep(&worker->segmentBuffers[i].nodes);
+    spill_file_close(&worker->segmentBuffers[i].spill);
+    frame_cache_free(&worker->segmentBuffers[i].cache);
+    audio_buffer_free(&worker->segmentBuffers[i].audio);
+    av_freep(&worker->segmentBuffers[i].timings);
+  }
+}
 
-    resetCodec();
-    pktListHeader = getYUVBufferList(startFramePos, endFramePos);
-    if (pktListHeader == NULL) {
-      LOGI(LOG_LEVEL, "pktListHeader is null.\n");
-      break;
+/* copies the decoded picture into the store, converting and scaling it to
+ * the store's size and format in the same pass; swscale is the fallback for
+ * the formats the pool has no fast path for */
+void copyFramePlanes(ReverseWorker *worker, SegmentBuffer *buffer,
+                     uint8_t *data[4]) {
+  ReverseContext *ctx = worker->ctx;
+  AVFrame *frame_src = worker->frame_src;
+  int64_t start = av_gettime();
+  int ret = frame_pool_store(&buffer->pool, data, frame_src->data,
+                             frame_src->linesize, frame_src->format,
+                             frame_src->width, frame_src->height);
+  if (ret == 0) {
+    worker->copyTime += av_gettime() - start;
+    return;
+  }
+  if (ret < 0) {
+    if (!worker->storeContext) {
+      LOGI(LOG_LEVEL, "[worker %d] no fast path from %dx%d %s, using swscale\n",
+           worker->index, frame_src->width, frame_src->height,
+           av_get_pix_fmt_name(frame_src->format));
+    }
+    worker->storeContext = sws_getCachedContext(worker->storeContext,
+        frame_src->width, frame_src->height, frame_src->format,
+        ctx->width, ctx->height, STREAM_PIX_FMT, SWS_BILINEAR,
+        NULL, NULL, NULL);
+    if (worker->storeContext) {
+      sws_scale(worker->storeContext, (const uint8_t * const *) frame_src->data,
+                frame_src->linesize, 0, frame_src->height,
+                data, buffer->pool.linesize);
+    } else {
+      LOGI(LOG_LEVEL, "Could not initialize the store conversion context\n");
     }
-    encodeYUVBufferList(encodeFramePos);
   }
-  ret = writeTrailer(formatContext_dst);
-end:
-  freeReuseBuffer();
-  //closeEncodeEnvironment();
-  //closeDecodeEnvironment();
-  return ret;
+  worker->convertTime += av_gettime() - start;
 }
 
-void closeEncodeEnvironment() {
-  if (formatContext_dst) {
-    avformat_close_input(&formatContext_dst);
+/* keeps the slot the decoder rendered the frame into, or copies the frame
+ * into a free one */
+void copyFrame2List(ReverseWorker *worker, SegmentBuffer *buffer) {
+  AVFrame *frame_src = worker->frame_src;
+  YUVBufferList* pItem = NULL;
+  int slot = -1;
+  if (frame_src->type == FF_BUFFER_TYPE_USER && frame_src->opaque == buffer) {
+    slot = frame_pool_slot_at(&buffer->pool, frame_src->data[0]);
+    if (frame_pool_keep(&buffer->pool, slot) < 0) {
+      /* the decoder returned a picture already stored */
+      slot = -1;
+    } else {
+      worker->renderedFrames++;
+    }
   }
-  if (frame_dst) {
-    av_free(frame_dst);
+  if (slot < 0) {
+    slot = frame_pool_acquire(&buffer->pool);
+    if (slot < 0) {
+      LOGI(LOG_LEVEL, "Frame pool is full, dropping frame\n");
+      return;
+    }
+    copyFramePlanes(worker, buffer, buffer->nodes[slot].data);
+  }
+  pItem = &buffer->nodes[slot];
+  pItem->next = (void*)buffer->pHeader;
+  pItem->prev = NULL;
+  if (buffer->pHeader) {
+    buffer->pHeader->prev = pItem;
+  } else {
+    buffer->pTail = pItem;
   }
-  if (st_dst && st_dst->codec) {
-    avcodec_close(st_dst->codec);
+  buffer->pHeader = pItem;
+  buffer->storedFrames++;
+}
+
+void copyFrame2Spill(ReverseWorker *worker, SegmentBuffer *buffer) {
+  uint8_t *data[4];
+  uint8_t *record = spill_file_frame(&buffer->spill, buffer->spillFrameCount);
+  if (!record) {
+    LOGI(LOG_LEVEL, "Could not map spill record %d\n", buffer->spillFrameCount);
+    return;
   }
+  frame_pool_planes_at(&buffer->pool, record, data);
+  copyFramePlanes(worker, buffer, data);
+  buffer->spillFrameCount++;
+  buffer->storedFrames++;
 }
 
-void closeDecodeEnvironment() {
-  if (formatContext_src) {
-    avformat_close_input(&formatContext_src);
+/* decodes into the free slot, then turns the previous newest frame into a
+ * delta against it */
+void copyFrame2Cache(ReverseWorker *worker, SegmentBuffer *buffer,
+                     int framePos) {
+  uint8_t *data[4];
+  int slot = !buffer->newestSlot;
+  int64_t start;
+  frame_pool_planes(&buffer->pool, slot, data);
+  copyFramePlanes(worker, buffer, data);
+  start = av_gettime();
+  frame_cache_append(&buffer->cache, frame_pool_slot(&buffer->pool, slot),
+                     frame_pool_slot(&buffer->pool, buffer->newestSlot),
+                     framePos);
+  worker->copyTime += av_gettime() - start;
+  buffer->newestSlot = slot;
+  buffer->newestPos = framePos;
+  buffer->storedFrames = buffer->cache.count + 1;
+}
+
+/* Starts the piece the next frames and samples belong to. Their packets
+ * may come out of the encoder later, writeChunkPacket() routes them. */
+int beginPiece(ReverseWorker *worker, int forward, int segment) {
+  ChunkPiece *piece;
+  if (worker->pieceCount == worker->pieceCapacity) {
+    int capacity = FFMAX(worker->pieceCapacity * 2, 8);
+    ChunkPiece *pieces = av_realloc(worker->pieces,
+                                    capacity * sizeof(ChunkPiece));
+    if (!pieces) {
+      return -1;
+    }
+    worker->pieces = pieces;
+    worker->pieceCapacity = capacity;
   }
-  if (frame_src) {
-    av_free(frame_src);
+  piece = &worker->pieces[worker->pieceCount++];
+  /* progressive output lists them beforehand, the muxer reads them */
+  if (worker->pieceCount > worker->plannedPieces) {
+    memset(piece, 0, sizeof(*piece));
+    piece->worker = worker;
+    piece->segment = segment;
+    piece->forward = forward;
   }
-  if (st_src && st_src->codec) {
-    avcodec_close(st_src->codec);
+  piece->startPts = worker->encodeFramePos;
+  piece->pcmOffset = worker->pcmSamples;
+  if (worker->pieceCursor == worker->pieceCount - 1) {
+    /* the pieces before are complete, restored from a checkpoint */
+    piece->offset = ftello(worker->chunk);
   }
+  /* a piece has to decode on its own */
+  worker->forceKeyframe = worker->ctx->segmentPieces;
+  return 0;
 }
 
-void freeReuseBuffer() {
-  if (fooContext) {
-    sws_freeContext(fooContext);
+/* Records a complete piece in the job manifest, its packets and PCM
+ * flushed first so the manifest never points past what is on disk. */
+void checkpointPiece(ReverseWorker *worker, const ChunkPiece *piece) {
+  ReverseContext *ctx = worker->ctx;
+  JobManifestPiece record;
+  if (piece->segment < 0) {
+    return;
+  }
+  record.worker = worker->index;
+  record.segment = piece->segment;
+  record.forward = piece->forward;
+  record.frames = piece->frames;
+  record.startPts = piece->startPts;
+  record.offset = piece->offset;
+  record.end = piece->end;
+  record.pcmOffset = piece->pcmOffset;
+  record.samples = piece->samples;
+  if (fflush(worker->chunk) != 0 ||
+      (worker->pcmChunk && fflush(worker->pcmChunk) != 0) ||
+      job_manifest_add(&ctx->manifest, &record) < 0) {
+    LOGI(LOG_LEVEL, "[worker %d] Could not checkpoint segment %d: %s\n",
+         worker->index, piece->segment, strerror(errno));
   }
 }
 
-int reverse(char *file_path_src, char *file_path_desc,
-            long positionUsStart, long positionUsEnd,
-            int video_stream_no, int audio_stream_no,
-            int subtitle_stream_no) {
-  const char *TMP_FOLDER = "/sdcard/Movies/localfile.mp4";
-  const char *TMP_FOLDER_DST = "/sdcard/Movies/r_localfile.mp4";
-  LOGI(LOG_LEVEL, "reversing...");
-  av_register_all();
-  return decode2YUV2Video(file_path_src, file_path_desc);
+/* Progressive output: the pieces the cursor has passed are on disk and
+ * the muxer may read them; finished tells it no more will come. */
+void publishPieces(ReverseWorker *worker, int finished) {
+  ReverseContext *ctx = worker->ctx;
+  if (fflush(worker->chunk) != 0 ||
+      (worker->pcmChunk && fflush(worker->pcmChunk) != 0)) {
+    LOGI(LOG_LEVEL, "[worker %d] Could not flush chunk: %s\n",
+         worker->index, strerror(errno));
+    worker->ret = -1;
+  }
+  pthread_mutex_lock(&ctx->mutexPieces);
+  if (worker->ret >= 0) {
+    worker->completedPieces = worker->pieceCursor;
+  }
+  worker->finished |= finished;
+  pthread_cond_broadcast(&ctx->condPieces);
+  pthread_mutex_unlock(&ctx->mutexPieces);
 }
 
+void endPiece(ReverseWorker *worker) {
+  ChunkPiece *piece;
+  if (worker->pieceCount == 0) {
+    return;
+  }
+  piece = &worker->pieces[worker->pieceCount - 1];
+  piece->frames = (int) (worker->encodeFramePos - piece->startPts);
+  piece->samples = worker->pcmSamples - piece->pcmOffset;
+}
 
+/* Moves the packet cursor to the piece of the frame shown at pts, or past
+ * the last piece when pts is past every frame (the chunk is complete).
+ * Pieces start with keyframes, so their packets do not interleave. */
+void movePieceCursor(ReverseWorker *worker, int64_t pts) {
+  off_t pos = ftello(worker->chunk);
+  int cursor = worker->pieceCursor;
+  while (worker->pieceCursor < worker->pieceCount &&
+         (worker->pieceCursor + 1 == worker->pieceCount
+          ? pts == INT64_MAX
+          : pts >= worker->pieces[worker->pieceCursor + 1].startPts)) {
+    worker->pieces[worker->pieceCursor].end = pos;
+    if (worker->ctx->checkpoint) {
+      checkpointPiece(worker, &worker->pieces[worker->pieceCursor]);
+    }
+    if (++worker->pieceCursor < worker->pieceCount) {
+      worker->pieces[worker->pieceCursor].offset = pos;
+    }
+  }
+  if (worker->ctx->progressive && worker->pieceCursor > cursor) {
+    publishPieces(worker, 0);
+  }
+}
 
+int writeChunkPacket(ReverseWorker *worker, AVPacket *pkt) {
+  ChunkPacketHeader header;
+  movePieceCursor(worker, pkt->pts);
+  header.pts = pkt->pts;
+  header.dts = pkt->dts;
+  header.size = pkt->size;
+  header.flags = pkt->flags;
+  if (fwrite(&header, sizeof(header), 1, worker->chunk) != 1 ||
+      fwrite(pkt->data, 1, pkt->size, worker->chunk) != (size_t) pkt->size) {
+    LOGI(LOG_LEVEL, "[output] write chunk failed: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* encodes frame (NULL flushes the encoder) into the chunk file; returns 1
+ * when a packet came out, 0 when none did and -1 on error */
+int encodeToChunk(ReverseWorker *worker, AVFrame *frame) {
+  int64_t start;
+  AVPacket pkt;
+  int got_output = 0;
+  int err;
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  /* encode the image */
+  start = av_gettime();
+  err = avcodec_encode_video2(worker->codecContext_dst, &pkt, frame,
+                              &got_output);
+  worker->encodeTime += av_gettime() - start;
+  if (err < 0) {
+    LOGI(LOG_LEVEL, "Error encoding frame\n");
+    return -1;
+  }
+  if (!got_output) {
+    return 0;
+  }
+  LOGI(LOG_LEVEL, "Encoding to video...[%d]", worker->encodeFramePos);
+  err = writeChunkPacket(worker, &pkt);
+  av_free_packet(&pkt);
+  return err < 0 ? -1 : 1;
+}
+
+/* Output timing of the frame encoded as n, in the source time base:
+ * mirrored around the range when reversed, end - (pts + duration), and
+ * from the start of the range when forward. With boomerang the reversed
+ * frames follow the whole forward range. */
+int setOutputTiming(ReverseWorker *worker, int n, const FrameTiming *timing,
+                    int forward) {
+  ReverseContext *ctx = worker->ctx;
+  FrameTiming *timings;
+  if (!timing) {
+    return 0;
+  }
+  /* reserved up front with progressive output, the muxer reads them */
+  if ((n + 1) * sizeof(FrameTiming) > worker->outTimingsSize) {
+    timings = (FrameTiming*)av_fast_realloc(worker->outTimings,
+                                            &worker->outTimingsSize,
+                                            (n + 1) * sizeof(FrameTiming));
+    if (!timings) {
+      LOGI(LOG_LEVEL, "[worker %d] Could not keep frame timing\n",
+           worker->index);
+      return -1;
+    }
+    worker->outTimings = timings;
+  }
+  timings = worker->outTimings;
+  timings[n].duration = timing->duration;
+  if (forward) {
+    timings[n].pts = timing->pts - ctx->rangeStartPts;
+  } else {
+    timings[n].pts = ctx->rangeEndPts - (timing->pts + timing->duration);
+    if (ctx->boomerang) {
+      timings[n].pts += ctx->rangeEndPts - ctx->rangeStartPts;
+    }
+  }
+  return 0;
+}
+
+/* timing of the buffer's frame stored as n, NULL without source timing */
+const FrameTiming *storedTiming(const SegmentBuffer *buffer, int n) {
+  return buffer->timings ? &buffer->timings[n] : NULL;
+}
+
+void encodeFrame(ReverseWorker *worker, uint8_t *data[4],
+                 const int linesize[4], const FrameTiming *timing,
+                 int forward) {
+  ReverseContext *ctx = worker->ctx;
+  AVFrame *frame_dst = worker->frame_dst;
+  int64_t start;
+  int i;
+  if (worker->fooContext) {
+    start = av_gettime();
+    sws_scale(worker->fooContext, (const uint8_t* const*)data,
+              linesize, 0, ctx->height,
+              frame_dst->data, frame_dst->linesize);
+    worker->convertTime += av_gettime() - start;
+  } else {
+    /* encoders copy what they keep, the slot only has to outlive the call */
+    for (i = 0; i < 4; i++) {
+      frame_dst->data[i] = data[i];
+      frame_dst->linesize[i] = linesize[i];
+    }
+  }
+  if (setOutputTiming(worker, worker->encodeFramePos, timing, forward) < 0) {
+    worker->ret = -1;
+  }
+  frame_dst->pts = worker->encodeFramePos++;
+  frame_dst->pict_type = worker->forceKeyframe ? AV_PICTURE_TYPE_I
+                                               : AV_PICTURE_TYPE_NONE;
+  worker->forceKeyframe = 0;
+  if (encodeToChunk(worker, frame_dst) < 0) {
+    worker->ret = -1;
+  }
+}
+
+/* drains the frames the encoder still holds back at the end of a chunk */
+void flushEncoder(ReverseWorker *worker) {
+  if (!(worker->codecContext_dst->codec->capabilities & CODEC_CAP_DELAY)) {
+    return;
+  }
+  while (encodeToChunk(worker, NULL) > 0) {
+  }
+}
+
+int encodeYUVBufferList(ReverseWorker *worker, SegmentBuffer *buffer) {
+  YUVBufferList* pItem = NULL;
+  int n = buffer->storedFrames;
+  while (buffer->pHeader) {
+    pItem = buffer->pHeader;
+    buffer->pHeader = pItem->next;
+    encodeFrame(worker, pItem->data, buffer->pool.linesize,
+                storedTiming(buffer, --n), 0);
+  }
+  return 0;
+}
+
+/* spilled records are read back last to first through the mapped window */
+int encodeSpilledFrames(ReverseWorker *worker, SegmentBuffer *buffer) {
+  uint8_t *data[4];
+  int n;
+  for (n = buffer->spillFrameCount - 1; n >= 0; n--) {
+    uint8_t *record = spill_file_frame(&buffer->spill, n);
+    if (!record) {
+      LOGI(LOG_LEVEL, "Could not map spill record %d\n", n);
+      return -1;
+    }
+    frame_pool_planes_at(&buffer->pool, record, data);
+    encodeFrame(worker, data, buffer->pool.linesize, storedTiming(buffer, n),
+                0);
+  }
+  return 0;
+}
+
+/* boomerang: the stored frames in display order, before they are encoded
+ * reversed */
+int encodeForwardFrames(ReverseWorker *worker, SegmentBuffer *buffer) {
+  YUVBufferList* pItem = NULL;
+  uint8_t *data[4];
+  int n;
+  if (buffer->segment->spill) {
+    for (n = 0; n < buffer->spillFrameCount; n++) {
+      uint8_t *record = spill_file_frame(&buffer->spill, n);
+      if (!record) {
+        LOGI(LOG_LEVEL, "Could not map spill record %d\n", n);
+        return -1;
+      }
+      frame_pool_planes_at(&buffer->pool, record, data);
+      encodeFrame(worker, data, buffer->pool.linesize,
+                  storedTiming(buffer, n), 1);
+    }
+    return 0;
+  }
+  for (pItem = buffer->pTail, n = 0; pItem; pItem = pItem->prev, n++) {
+    encodeFrame(worker, pItem->data, buffer->pool.linesize,
+                storedTiming(buffer, n), 1);
+  }
+  return 0;
+}
+
+/* The frame cache drops its oldest frames when it runs full, so their
+ * timings are kept by display position from the planned segment's start
+ * rather than in the order stored. */
+int cachedTimingIndex(ReverseWorker *worker, const SegmentBuffer *buffer,
+                      int framePos) {
+  return framePos -
+         worker->ctx->segments[buffer->segmentIndex].startFramePos;
+}
+
+/* the newest frame first, then every older one restored from its delta */
+int encodeCachedFrames(ReverseWorker *worker, SegmentBuffer *buffer) {
+  uint8_t *data[4];
+  uint8_t *newest = frame_pool_slot(&buffer->pool, buffer->newestSlot);
+  int64_t start;
+  int pos = buffer->newestPos;
+  frame_pool_planes(&buffer->pool, buffer->newestSlot, data);
+  do {
+    encodeFrame(worker, data, buffer->pool.linesize,
+                storedTiming(buffer, cachedTimingIndex(worker, buffer, pos)),
+                0);
+    start = av_gettime();
+    pos = frame_cache_step_back(&buffer->cache, newest);
+    worker->copyTime += av_gettime() - start;
+  } while (pos >= 0);
+  return 0;
+}
+
+int getFrameDisplayPos(ReverseWorker *worker, int countedFramePos) {
+  ReverseContext *ctx = worker->ctx;
+  int64_t pts;
+  if (!ctx->hasDisplayOrder) {
+    return countedFramePos;
+  }
+  pts = av_frame_get_best_effort_timestamp(worker->frame_src);
+  if (pts == AV_NOPTS_VALUE) {
+    return countedFramePos;
+  }
+  return packet_index_display_pos(&ctx->packetIndex, pts);
+}
+
+/* keeps the timing of the frame just stored as n */
+void storeFrameTiming(ReverseWorker *worker, SegmentBuffer *buffer, int n,
+                      int framePos) {
+  FrameTiming *timings = (FrameTiming*)av_fast_realloc(
+      buffer->timings, &buffer->timingsSize, (n + 1) * sizeof(FrameTiming));
+  if (!timings) {
+    LOGI(LOG_LEVEL, "[worker %d] Could not keep frame timing\n",
+         worker->index);
+    worker->ret = -1;
+    return;
+  }
+  buffer->timings = timings;
+  timings[n] = getFrameTiming(worker->ctx, framePos,
+                              av_frame_get_best_effort_timestamp(
+                                  worker->frame_src));
+}
+
+/* Decodes the segment into the buffer's frame pool (or its spill file) and
+ * returns the number of frames stored. */
+int getYUVBufferList(ReverseWorker *worker, const ReverseSegment *segment,
+                     SegmentBuffer *buffer) {
+  ReverseContext *ctx = worker->ctx;
+  int framePos = segment->seekFramePos;
+  int eof = 0;
+  int got_frame = 0;
+  int64_t start;
+  AVPacket pt_src;
+  LOGI(LOG_LEVEL, "[worker %d] start pos: %d, end pos: %d, seek pos: %d\n",
+       worker->index, segment->startFramePos, segment->endFramePos,
+       segment->seekFramePos);
+  buffer->segment = segment;
+  buffer->pHeader = NULL;
+  buffer->pTail = NULL;
+  buffer->spillFrameCount = 0;
+  buffer->storedFrames = 0;
+  frame_pool_reset(&buffer->pool);
+  frame_cache_reset(&buffer->cache);
+  /* spilled frames are copied to the spill file anyway */
+  worker->renderBuffer = ctx->directRender && !segment->spill ? buffer : NULL;
+  while (framePos <= segment->endFramePos && !isCancelled(ctx)) {
+    av_init_packet(&pt_src);
+    pt_src.data = NULL;
+    pt_src.size = 0;
+    start = av_gettime();
+    if (!eof && av_read_frame(worker->formatContext_src, &pt_src) < 0) {
+      eof = 1;
+    }
+    worker->demuxTime += av_gettime() - start;
+    if (eof) {
+      /* empty packets drain the frames still delayed in the decoder */
+      pt_src.stream_index = ctx->stream_index;
+    }
+    if (pt_src.stream_index == ctx->stream_index) {
+      start = av_gettime();
+      avcodec_decode_video2(worker->st_src->codec, worker->frame_src,
+                            &got_frame, &pt_src);
+      worker->decodeTime += av_gettime() - start;
+      if (got_frame) {
+        worker->decodedFrames++;
+        framePos = getFrameDisplayPos(worker, framePos);
+        if (framePos >= segment->startFramePos &&
+            framePos <= segment->endFramePos) {
+          int stored = buffer->storedFrames;
+          LOGI(LOG_LEVEL, "video_frame n:%d coded_n:%d pts:%s\n",
+               framePos, worker->frame_src->coded_picture_number,
+               av_ts2timestr(worker->frame_src->pts,
+                             &worker->st_src->codec->time_base));
+          if (ctx->frameCache) {
+            copyFrame2Cache(worker, buffer, framePos);
+          } else if (segment->spill) {
+            copyFrame2Spill(worker, buffer);
+          } else {
+            copyFrame2List(worker, buffer);
+          }
+          if (ctx->sourceTiming && ctx->frameCache) {
+            storeFrameTiming(worker, buffer,
+                             cachedTimingIndex(worker, buffer, framePos),
+                             framePos);
+          } else if (ctx->sourceTiming && buffer->storedFrames > stored) {
+            storeFrameTiming(worker, buffer, buffer->storedFrames - 1,
+                             framePos);
+          }
+        }
+        framePos++;
+      } else if (eof) {
+        LOGI(LOG_LEVEL, "No frame to read. frameCount:%d\n", framePos);
+        break;
+      }
+    }
+    av_free_packet(&pt_src);
+  }
+  worker->renderBuffer = NULL;
+  return buffer->storedFrames;
+}
+
+/* Decodes the audio shown with the segment, from its first frame to the
+ * frame after its last, so neighbouring segments meet sample-exactly. */
+void getAudioBuffer(ReverseWorker *worker, const ReverseSegment *segment,
+                    SegmentBuffer *buffer) {
+  ReverseContext *ctx = worker->ctx;
+  AVRational sampleTimeBase = {1, ctx->audioSampleRate};
+  int64_t start, end, startTime;
+  buffer->storedAudio = 0;
+  if (ctx->audioStreamIndex < 0 || isCancelled(ctx)) {
+    return;
+  }
+  start = av_rescale_q(getFramePts(ctx, segment->startFramePos),
+                       ctx->st_src->time_base, sampleTimeBase);
+  end = av_rescale_q(getFramePts(ctx, segment->endFramePos + 1),
+                     ctx->st_src->time_base, sampleTimeBase);
+  startTime = av_gettime();
+  buffer->storedAudio = audio_reverse_decode(&worker->audio, &buffer->audio,
+                                             start, end);
+  worker->audioTime += av_gettime() - startTime;
+  if (buffer->storedAudio < 0) {
+    LOGI(LOG_LEVEL, "[worker %d] audio decoding failed: %d\n", worker->index,
+         buffer->storedAudio);
+  }
+}
+
+/* appends the segment's audio to the PCM chunk, reversed unless forward;
+ * the reversal is in place, so forward comes first */
+int writeAudioChunk(ReverseWorker *worker, SegmentBuffer *buffer,
+                    int forward) {
+  ReverseContext *ctx = worker->ctx;
+  AudioBuffer *audio = &buffer->audio;
+  if (ctx->audioStreamIndex < 0) {
+    return 0;
+  }
+  if (buffer->storedAudio < 0) {
+    return -1;
+  }
+  if (!forward) {
+    audio_reverse_samples(audio, ctx->audioSampleSize);
+  }
+  if (audio->samples > 0 &&
+      fwrite(audio->data, ctx->audioSampleSize, audio->samples,
+             worker->pcmChunk) != (size_t) audio->samples) {
+    LOGI(LOG_LEVEL, "[output] write PCM chunk failed: %s\n", strerror(errno));
+    return -1;
+  }
+  worker->pcmSamples += audio->samples;
+  return 0;
+}
+
+void *fillSegmentHandOff(void *obj) {
+  return av_mallocz(sizeof(SegmentHandOff));
+}
+
+void freeSegmentHandOff(void *obj, void *elem) {
+  av_free(elem);
+}
+
+void handOffBuffer(ReverseWorker *worker, Queue *queue, SegmentBuffer *buffer) {
+  int to_write;
+  SegmentHandOff *elem = queue_push_start(queue, &worker->mutexHandOff,
+                                          &worker->condHandOff, &to_write,
+                                          NULL, NULL, NULL);
+  elem->buffer = buffer;
+  queue_push_finish(queue, &worker->mutexHandOff, &worker->condHandOff,
+                    to_write);
+}
+
+SegmentBuffer *takeBuffer(ReverseWorker *worker, Queue *queue) {
+  SegmentHandOff *elem = queue_pop_start(&queue, &worker->mutexHandOff,
+                                         &worker->condHandOff, NULL, NULL,
+                                         NULL);
+  SegmentBuffer *buffer = elem->buffer;
+  queue_pop_finish(queue, &worker->mutexHandOff, &worker->condHandOff);
+  return buffer;
+}
+
+int initHandOff(ReverseWorker *worker) {
+  int i;
+  /* queue.c keeps one slot empty: room for every buffer plus the end mark */
+  worker->freeBuffers = queue_init_with_custom_lock(SEGMENT_BUFFER_COUNT + 1,
+      fillSegmentHandOff, freeSegmentHandOff, NULL, NULL,
+      &worker->mutexHandOff, &worker->condHandOff);
+  worker->filledBuffers = queue_init_with_custom_lock(SEGMENT_BUFFER_COUNT + 2,
+      fillSegmentHandOff, freeSegmentHandOff, NULL, NULL,
+      &worker->mutexHandOff, &worker->condHandOff);
+  if (!worker->freeBuffers || !worker->filledBuffers) {
+    return -1;
+  }
+  for (i = 0; i < SEGMENT_BUFFER_COUNT; i++) {
+    handOffBuffer(worker, worker->freeBuffers, &worker->segmentBuffers[i]);
+  }
+  return 0;
+}
+
+void freeHandOff(ReverseWorker *worker) {
+  if (worker->freeBuffers) {
+    queue_free(worker->freeBuffers, &worker->mutexHandOff,
+               &worker->condHandOff, NULL);
+    worker->freeBuffers = NULL;
+  }
+  if (worker->filledBuffers) {
+    queue_free(worker->filledBuffers, &worker->mutexHandOff,
+               &worker->condHandOff, NULL);
+    worker->filledBuffers = NULL;
+  }
+}
+
+/* Decodes the segment into one buffer, or into several from its end back
+ * when the frame cache runs full: the frames before the oldest one kept
+ * are decoded again into the next buffer. */
+void decodeSegment(ReverseWorker *worker, const ReverseSegment *segment) {
+  ReverseContext *ctx = worker->ctx;
+  int endFramePos = segment->endFramePos;
+  while (endFramePos >= segment->startFramePos && !isCancelled(ctx)) {
+    SegmentBuffer *buffer = takeBuffer(worker, worker->freeBuffers);
+    buffer->segmentIndex = (int) (segment - ctx->segments);
+    buffer->part = *segment;
+    buffer->part.endFramePos = endFramePos;
+    seekSegment(worker, &buffer->part);
+    getYUVBufferList(worker, &buffer->part, buffer);
+    endFramePos = -1;
+    if (ctx->frameCache && buffer->cache.evicted > 0) {
+      LOGI(LOG_LEVEL, "[worker %d] frame cache full, frames %d-%d decode again\n",
+           worker->index, segment->startFramePos, buffer->cache.basePos - 1);
+      buffer->part.startFramePos = buffer->cache.basePos;
+      endFramePos = buffer->cache.basePos - 1;
+    }
+    getAudioBuffer(worker, &buffer->part, buffer);
+    handOffBuffer(worker, worker->filledBuffers, buffer);
+  }
+}
+
+/* decoder thread: fills free buffers from the worker's last segment to its
+ * first */
+void *decodeSegments(void *data) {
+  ReverseWorker *worker = (ReverseWorker*)data;
+  ReverseContext *ctx = worker->ctx;
+  int i;
+  for (i = worker->lastSegment; i >= worker->firstSegment && !isCancelled(ctx);
+       i--) {
+    decodeSegment(worker, &ctx->segments[i]);
+  }
+  handOffBuffer(worker, worker->filledBuffers, NULL);
+  return NULL;
+}
+
+/* boomerang: the buffer forward in a piece of its own, then the piece its
+ * reversal goes to */
+int encodeForwardPiece(ReverseWorker *worker, SegmentBuffer *buffer) {
+  if (beginPiece(worker, 1, buffer->segmentIndex) < 0 ||
+      encodeForwardFrames(worker, buffer) < 0 ||
+      writeAudioChunk(worker, buffer, 1) < 0) {
+    return -1;
+  }
+  endPiece(worker);
+  return beginPiece(worker, 0, buffer->segmentIndex);
+}
+
+/* a piece for each segment, which the frame cache may have split over
+ * several buffers */
+int beginSegmentPiece(ReverseWorker *worker, int segment) {
+  if (worker->pieceCount > 0 &&
+      worker->pieces[worker->pieceCount - 1].segment == segment) {
+    return 0;
+  }
+  return beginPiece(worker, 0, segment);
+}
+
+/* encoder side: drains every filled buffer in reverse order */
+void encodeSegments(ReverseWorker *worker) {
+  ReverseContext *ctx = worker->ctx;
+  SegmentBuffer *buffer;
+  while ((buffer = takeBuffer(worker, worker->filledBuffers)) != NULL) {
+    if (isCancelled(ctx)) {
+      /* drop the segment, the decoder still has to reach its end marker */
+      handOffBuffer(worker, worker->freeBuffers, buffer);
+      continue;
+    }
+    if (ctx->boomerang) {
+      if (encodeForwardPiece(worker, buffer) < 0) {
+        worker->ret = -1;
+      }
+    } else if (ctx->segmentPieces &&
+               beginSegmentPiece(worker, buffer->segmentIndex) < 0) {
+      worker->ret = -1;
+    }
+    if (buffer->storedFrames <= 0) {
+      LOGI(LOG_LEVEL, "segment %d-%d is empty.\n",
+           buffer->segment->startFramePos, buffer->segment->endFramePos);
+    } else if (ctx->frameCache) {
+      LOGI(LOG_LEVEL, "[worker %d] %d frames cached in %zu bytes\n",
+           worker->index, buffer->storedFrames,
+           frame_cache_used(&buffer->cache) + buffer->pool.slotSize);
+      encodeCachedFrames(worker, buffer);
+    } else if (buffer->segment->spill) {
+      if (encodeSpilledFrames(worker, buffer) < 0) {
+        worker->ret = -1;
+      }
+    } else {
+      encodeYUVBufferList(worker, buffer);
+    }
+    if (writeAudioChunk(worker, buffer, 0) < 0) {
+      worker->ret = -1;
+    }
+    if (ctx->segmentPieces) {
+      endPiece(worker);
+    }
+    handOffBuffer(worker, worker->freeBuffers, buffer);
+  }
+}
+
+/* the packets of a segment in presentation order, within its range */
+int readSegmentPackets(ReverseWorker *worker, const ReverseSegment *segment) {
+  ReverseContext *ctx = worker->ctx;
+  AVPacket pkt;
+  int count = 0;
+  while (count < ctx->segmentFrames && !isCancelled(ctx)) {
+    int64_t start = av_gettime();
+    int pos, err;
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    err = av_read_frame(worker->formatContext_src, &pkt);
+    worker->demuxTime += av_gettime() - start;
+    if (err < 0) {
+      break;
+    }
+    if (pkt.stream_index != ctx->stream_index) {
+      av_free_packet(&pkt);
+      continue;
+    }
+    pos = packet_index_display_pos(&ctx->packetIndex, pkt.pts);
+    if (pos > segment->endFramePos) {
+      av_free_packet(&pkt);
+      break;
+    }
+    if (pos < segment->startFramePos || av_dup_packet(&pkt) < 0) {
+      av_free_packet(&pkt);
+      continue;
+    }
+    worker->packets[count++] = pkt;
+  }
+  return count;
+}
+
+/* renumbers a copied packet like an encoded frame, keeping its timing */
+int numberCopiedPacket(ReverseWorker *worker, AVPacket *pkt, int forward) {
+  ReverseContext *ctx = worker->ctx;
+  if (ctx->sourceTiming) {
+    FrameTiming timing = getFrameTiming(ctx,
+        packet_index_display_pos(&ctx->packetIndex, pkt->pts), pkt->pts);
+    if (setOutputTiming(worker, worker->encodeFramePos, &timing,
+                        forward) < 0) {
+      return -1;
+    }
+  }
+  pkt->pts = pkt->dts = worker->encodeFramePos++;
+  return 0;
+}
+
+/* Stream copy: every segment is read forward and its packets written to
+ * the chunk backwards (with "boomerang" forward first), renumbered like
+ * encoded frames. */
+void copySegments(ReverseWorker *worker) {
+  ReverseContext *ctx = worker->ctx;
+  SegmentBuffer *buffer = &worker->segmentBuffers[0];
+  int i, n;
+  for (i = worker->lastSegment; i >= worker->firstSegment && !isCancelled(ctx);
+       i--) {
+    int count;
+    seekSegment(worker, &ctx->segments[i]);
+    count = readSegmentPackets(worker, &ctx->segments[i]);
+    getAudioBuffer(worker, &ctx->segments[i], buffer);
+    if (ctx->boomerang) {
+      if (beginPiece(worker, 1, i) < 0) {
+        worker->ret = -1;
+      }
+      for (n = 0; n < count; n++) {
+        AVPacket *pkt = &worker->packets[n];
+        AVPacket copy = *pkt;
+        /* the packet is written again reversed, with its own timestamps */
+        if (numberCopiedPacket(worker, &copy, 1) < 0 ||
+            writeChunkPacket(worker, &copy) < 0) {
+          worker->ret = -1;
+        }
+      }
+      if (writeAudioChunk(worker, buffer, 1) < 0) {
+        worker->ret = -1;
+      }
+      endPiece(worker);
+      if (beginPiece(worker, 0, i) < 0) {
+        worker->ret = -1;
+      }
+    } else if (ctx->segmentPieces && beginPiece(worker, 0, i) < 0) {
+      worker->ret = -1;
+    }
+    for (n = count - 1; n >= 0; n--) {
+      AVPacket *pkt = &worker->packets[n];
+      if (numberCopiedPacket(worker, pkt, 0) < 0 ||
+          writeChunkPacket(worker, pkt) < 0) {
+        worker->ret = -1;
+      }
+      av_free_packet(pkt);
+    }
+    if (writeAudioChunk(worker, buffer, 0) < 0) {
+      worker->ret = -1;
+    }
+    if (ctx->segmentPieces) {
+      endPiece(worker);
+    }
+  }
+}
+
+/* worker thread: runs its own decoder thread and encodes what it hands
+ * over into the chunk file */
+void *runWorker(void *data) {
+  ReverseWorker *worker = (ReverseWorker*)data;
+  pthread_t decodeThread;
+  int err;
+  /* without pieces per segment the whole chunk is one piece */
+  if (!worker->ctx->segmentPieces && beginPiece(worker, 0, -1) < 0) {
+    worker->ret = -1;
+    return NULL;
+  }
+  if (worker->ctx->streamCopy) {
+    copySegments(worker);
+  } else {
+    err = pthread_create(&decodeThread, NULL, decodeSegments, worker);
+    if (err != 0) {
+      LOGI(LOG_LEVEL, "Could not create decode thread: %d\n", err);
+      worker->ret = -1;
+      return NULL;
+    }
+    encodeSegments(worker);
+    pthread_join(decodeThread, NULL);
+    flushEncoder(worker);
+  }
+  if (!worker->ctx->segmentPieces) {
+    endPiece(worker);
+  }
+  movePieceCursor(worker, INT64_MAX);
+  if (fflush(worker->chunk) != 0 ||
+      (worker->pcmChunk && fflush(worker->pcmChunk) != 0)) {
+    worker->ret = -1;
+  }
+  LOGI(LOG_LEVEL, "[worker %d] segments %d-%d: %d frames, encoder %.1f fps\n",
+       worker->index, worker->firstSegment, worker->lastSegment,
+       worker->encodeFramePos,
+       worker->encodeTime > 0
+       ? worker->encodeFramePos * 1000000.0 / worker->encodeTime : 0.0);
+  return NULL;
+}
+
+/* progressive output: the muxer waits on the worker, which has to tell it
+ * when it stops, whatever made it stop */
+void *runProgressiveWorker(void *data) {
+  ReverseWorker *worker = (ReverseWorker*)data;
+  runWorker(worker);
+  publishPieces(worker, 1);
+  return NULL;
+}
+
+int addSegment(ReverseContext *ctx, int startFramePos, int endFramePos,
+               const ReverseSegment *seek, int spill) {
+  ReverseSegment *segment = &ctx->segments[ctx->segmentCount++];
+  segment->startFramePos = startFramePos;
+  segment->endFramePos = endFramePos;
+  segment->seekFramePos = seek->seekFramePos;
+  segment->seekTimestamp = seek->seekTimestamp;
+  segment->spill = spill;
+  return spill;
+}
+
+/* Collects one entry per GOP (display range plus the keyframe to seek to).
+ * Frames shown before the first keyframe are decoded with the first GOP. */
+int findGops(ReverseContext *ctx, ReverseSegment *gops) {
+  int i, gopCount = 0;
+  for (i = 0; i < ctx->packetIndex.count; i++) {
+    PacketIndexEntry *entry = &ctx->packetIndex.entries[i];
+    int keyPos;
+    if (!(entry->flags & AV_PKT_FLAG_KEY)) {
+      continue;
+    }
+    keyPos = packet_index_display_pos(&ctx->packetIndex, entry->pts);
+    if (gopCount > 0 && keyPos <= gops[gopCount - 1].startFramePos) {
+      continue;
+    }
+    gops[gopCount].startFramePos = gopCount == 0 ? 0 : keyPos;
+    gops[gopCount].seekFramePos = keyPos;
+    gops[gopCount].seekTimestamp = entry->dts != AV_NOPTS_VALUE ? entry->dts
+                                                                : entry->pts;
+    gopCount++;
+  }
+  for (i = 0; i < gopCount; i++) {
+    gops[i].endFramePos = i + 1 < gopCount ? gops[i + 1].startFramePos - 1
+                                           : ctx->frameCount - 1;
+  }
+  return gopCount;
+}
+
+/* Keeps the GOPs overlapping the requested range, clipped to it. Frames of
+ * a clipped GOP before the range are still decoded, but never stored. */
+int clipGops(ReverseContext *ctx, ReverseSegment *gops, int gopCount) {
+  int i, kept = 0;
+  for (i = 0; i < gopCount; i++) {
+    if (gops[i].endFramePos < ctx->rangeStartPos ||
+        gops[i].startFramePos > ctx->rangeEndPos) {
+      continue;
+    }
+    gops[kept] = gops[i];
+    gops[kept].startFramePos = FFMAX(gops[i].startFramePos, ctx->rangeStartPos);
+    gops[kept].endFramePos = FFMIN(gops[i].endFramePos, ctx->rangeEndPos);
+    kept++;
+  }
+  return kept;
+}
+
+/* A budget larger than the range needs would make a single segment of it,
+ * leaving all workers but one without work, and allocate pools no frame is
+ * ever stored in. Segments are kept to a worker's share of the range, or to
+ * the longest GOP in it so no GOP is cut. */
+void capSegmentFrames(ReverseContext *ctx) {
+  ReverseSegment *gops;
+  int i, gopCount, longest;
+  int rangeFrames = ctx->rangeEndPos - ctx->rangeStartPos + 1;
+  int share = (rangeFrames + ctx->workerCount - 1) / ctx->workerCount;
+  if (ctx->memoryBudget <= 0 || ctx->frameCache ||
+      ctx->segmentFrames <= share) {
+    return;
+  }
+  gops = (ReverseSegment*)av_malloc(
+      (ctx->packetIndex.keyframeCount + 1) * sizeof(ReverseSegment));
+  if (!gops) {
+    return;
+  }
+  gopCount = ctx->hasDisplayOrder ? clipGops(ctx, gops, findGops(ctx, gops))
+                                  : 0;
+  longest = gopCount == 0 ? rangeFrames : 0;
+  for (i = 0; i < gopCount; i++) {
+    longest = FFMAX(longest, gops[i].endFramePos - gops[i].startFramePos + 1);
+  }
+  av_free(gops);
+  ctx->segmentFrames = FFMIN(ctx->segmentFrames, FFMAX(share, longest));
+  LOGI(LOG_LEVEL, "capSegmentFrames: %d frames per segment\n",
+       ctx->segmentFrames);
+}
+
+/* Plans a GOP longer than segmentFrames. Cut into parts, each part decodes
+ * again from the keyframe through its last frame, so the frames decoded for
+ * nothing are the lead-ins of the parts: with the short remainder first and
+ * full parts after it they are as few as they can be. Spilling decodes the
+ * GOP once but writes and reads back every frame, SPILL_FRAME_COST of a
+ * decode each; it is used when allowSpill is set and costs less. Returns 1
+ * if the GOP was spilled. */
+int planLongGop(ReverseContext *ctx, const ReverseSegment *gop,
+                int allowSpill) {
+  int frames = gop->endFramePos - gop->startFramePos + 1;
+  int lead = FFMAX(gop->startFramePos - gop->seekFramePos, 0);
+  int parts = (frames + ctx->segmentFrames - 1) / ctx->segmentFrames;
+  int first = frames - (parts - 1) * ctx->segmentFrames;
+  int start, size;
+  /* frames decoded beyond what spilling decodes */
+  int64_t redecoded = (int64_t) (parts - 1) * (lead + first) +
+      (int64_t) ctx->segmentFrames * (parts - 1) * (parts - 2) / 2;
+  if (allowSpill && redecoded > frames * SPILL_FRAME_COST) {
+    return addSegment(ctx, gop->startFramePos, gop->endFramePos, gop, 1);
+  }
+  for (start = gop->startFramePos, size = first; start <= gop->endFramePos;
+       start += size, size = ctx->segmentFrames) {
+    addSegment(ctx, start, start + size - 1, gop, 0);
+  }
+  return 0;
+}
+
+/* Segments are whole GOPs grouped up to segmentFrames frames, so every
+ * segment starts decoding at its own keyframe and each frame is decoded
+ * about once. Only a GOP longer than that is cut or spilled, see
+ * planLongGop(). Returns the number of spill segments. */
+int planSegments(ReverseContext *ctx, int allowSpill) {
+  int i, gopCount, segStart = -1, spillCount = 0;
+  int64_t decodes = 0, frames = 0;
+  ReverseSegment *gops = NULL;
+  ReverseSegment *segSeek = NULL;
+  ReverseSegment fromStart = {0, 0, 0, 0, 0};
+
+  ctx->segmentCount = 0;
+  av_freep(&ctx->segments);
+  ctx->segments = (ReverseSegment*)av_malloc(
+      (ctx->packetIndex.keyframeCount +
+       ctx->frameCount / ctx->segmentFrames + 2) *
+      sizeof(ReverseSegment));
+  gops = (ReverseSegment*)av_malloc(
+      (ctx->packetIndex.keyframeCount + 1) * sizeof(ReverseSegment));
+  if (!ctx->segments || !gops) {
+    av_free(gops);
+    return -1;
+  }
+  gopCount = ctx->hasDisplayOrder ? clipGops(ctx, gops, findGops(ctx, gops))
+                                  : 0;
+  if (gopCount == 0) {
+    /* no keyframe could be placed in display order, decode from the start */
+    gops[0] = fromStart;
+    gops[0].startFramePos = ctx->rangeStartPos;
+    gops[0].endFramePos = ctx->rangeEndPos;
+    gopCount = 1;
+  }
+  for (i = 0; i < gopCount; i++) {
+    ReverseSegment *gop = &gops[i];
+    int gopFrames = gop->endFramePos - gop->startFramePos + 1;
+    if (segStart >= 0 &&
+        gop->endFramePos - segStart + 1 > ctx->segmentFrames) {
+      addSegment(ctx, segStart, gop->startFramePos - 1, segSeek, 0);
+      segStart = -1;
+    }
+    if (gopFrames > ctx->segmentFrames) {
+      spillCount += planLongGop(ctx, gop, allowSpill);
+      continue;
+    }
+    if (segStart < 0) {
+      segStart = gop->startFramePos;
+      segSeek = gop;
+    }
+  }
+  if (segStart >= 0 && segStart <= ctx->rangeEndPos) {
+    addSegment(ctx, segStart, ctx->rangeEndPos, segSeek, 0);
+  }
+  av_free(gops);
+  for (i = 0; i < ctx->segmentCount; i++) {
+    ReverseSegment *segment = &ctx->segments[i];
+    decodes += segment->endFramePos - segment->seekFramePos + 1;
+    frames += segment->endFramePos - segment->startFramePos + 1;
+  }
+  LOGI(LOG_LEVEL, "planSegments: %d frames, %d GOPs, %d segments, %d spilled, "
+       "%.2f decodes per frame\n", ctx->frameCount, gopCount,
+       ctx->segmentCount, spillCount, frames > 0 ? (double) decodes / frames
+                                                : 0.0);
+  return spillCount;
+}
+
+/* Hands each worker a contiguous run of segments covering about the same
+ * share of the range, at least one segment each. */
+void assignWorkerSegments(ReverseContext *ctx) {
+  int w, first = 0;
+  int rangeFrames = ctx->rangeEndPos - ctx->rangeStartPos + 1;
+  for (w = 0; w < ctx->workerCount; w++) {
+    int64_t limit = ctx->rangeStartPos +
+                    (int64_t) (w + 1) * rangeFrames / ctx->workerCount;
+    int last = first;
+    while (last + 1 < ctx->segmentCount - (ctx->workerCount - 1 - w) &&
+           ctx->segments[last + 1].startFramePos < limit) {
+      last++;
+    }
+    if (w == ctx->workerCount - 1) {
+      last = ctx->segmentCount - 1;
+    }
+    ctx->workers[w].firstSegment = first;
+    ctx->workers[w].lastSegment = last;
+    first = last + 1;
+  }
+}
+
+int allocWorkers(ReverseContext *ctx, int count) {
+  int i;
+  ctx->workers = (ReverseWorker*)av_mallocz(count * sizeof(ReverseWorker));
+  ctx->workerCount = ctx->workers ? count : 0;
+  if (!ctx->workers) {
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    ReverseWorker *worker = &ctx->workers[i];
+    int j;
+    worker->ctx = ctx;
+    worker->index = i;
+    for (j = 0; j < SEGMENT_BUFFER_COUNT; j++) {
+      worker->segmentBuffers[j].spill.fd = -1;
+    }
+    pthread_mutex_init(&worker->mutexHandOff, NULL);
+    pthread_cond_init(&worker->condHandOff, NULL);
+  }
+  return 0;
+}
+
+/* codecs are opened and closed here, on the calling thread, as libavcodec
+ * needs a lock manager to open them concurrently */
+int initWorker(ReverseWorker *worker, const char* SRC_FILE,
+               const char* OUT_FMT_FILE) {
+  ReverseContext *ctx = worker->ctx;
+  if (initWorkerDecoder(worker, SRC_FILE) < 0) {
+    LOGI(LOG_LEVEL, "initWorkerDecoder error.\n");
+    return -1;
+  }
+  if (ctx->streamCopy) {
+    worker->packets = (AVPacket*)av_mallocz(ctx->segmentFrames *
+                                            sizeof(AVPacket));
+    if (!worker->packets) {
+      return -1;
+    }
+  } else {
+    if (initWorkerEncoder(worker) < 0) {
+      LOGI(LOG_LEVEL, "initWorkerEncoder error.\n");
+      return -1;
+    }
+    // initReuseBuffer must be after initWorkerEncoder
+    if (initReuseBuffer(worker) < 0) {
+      LOGI(LOG_LEVEL, "initReuseBuffer error.\n");
+      return -1;
+    }
+    if (initSegmentBuffers(worker) < 0) {
+      LOGI(LOG_LEVEL, "initSegmentBuffers error.\n");
+      return -1;
+    }
+  }
+  worker->chunk = openChunkFile(worker, OUT_FMT_FILE, "chunk",
+                                &worker->muxChunk);
+  if (!worker->chunk) {
+    return -1;
+  }
+  if (ctx->audioStreamIndex >= 0) {
+    if (audio_reverse_open(&worker->audio, SRC_FILE, ctx->audioStreamIndex,
+                           ctx->audioSampleFmt, ctx->audioChannelLayout) < 0) {
+      LOGI(LOG_LEVEL, "Could not open audio stream %d\n",
+           ctx->audioStreamIndex);
+      return -1;
+    }
+    worker->pcmChunk = openChunkFile(worker, OUT_FMT_FILE, "pcm",
+                                     &worker->muxPcmChunk);
+    if (!worker->pcmChunk) {
+      return -1;
+    }
+  }
+  if (initHandOff(worker) < 0) {
+    LOGI(LOG_LEVEL, "initHandOff error.\n");
+    return -1;
+  }
+  return 0;
+}
+
+void freeWorkers(ReverseContext *ctx) {
+  int i;
+  for (i = 0; i < ctx->workerCount; i++) {
+    ReverseWorker *worker = &ctx->workers[i];
+    freeHandOff(worker);
+    /* the decoder releases the slots it still holds as it closes */
+    if (worker->st_src && worker->st_src->codec) {
+      avcodec_close(worker->st_src->codec);
+    }
+    freeSegmentBuffers(worker);
+    if (worker->muxChunk && worker->muxChunk != worker->chunk) {
+      fclose(worker->muxChunk);
+    }
+    if (worker->muxPcmChunk && worker->muxPcmChunk != worker->pcmChunk) {
+      fclose(worker->muxPcmChunk);
+    }
+    if (worker->chunk) {
+      fclose(worker->chunk);
+    }
+    if (worker->pcmChunk) {
+      fclose(worker->pcmChunk);
+    }
+    audio_reverse_close(&worker->audio);
+    sws_freeContext(worker->storeContext);
+    if (worker->fooContext) {
+      /* frame_dst owns a picture only when there is a conversion */
+      sws_freeContext(worker->fooContext);
+      avpicture_free((AVPicture *)worker->frame_dst);
+    }
+    av_free(worker->frame_dst);
+    av_freep(&worker->outTimings);
+    if (worker->codecContext_dst) {
+      avcodec_close(worker->codecContext_dst);
+      av_free(worker->codecContext_dst);
+    }
+    if (worker->formatContext_src) {
+      avformat_close_input(&worker->formatContext_src);
+    }
+    av_free(worker->frame_src);
+    av_free(worker->packets);
+    av_free(worker->pieces);
+    pthread_mutex_destroy(&worker->mutexHandOff);
+    pthread_cond_destroy(&worker->condHandOff);
+  }
+  av_freep(&ctx->workers);
+  ctx->workerCount = 0;
+}
+
+/* The audio encoder runs once, in the final mux, so the stream has no
+ * seams where the workers' PCM chunks meet. */
+int openAudioOutput(ReverseContext *ctx) {
+  AVCodecContext *c;
+  ctx->st_audio = avformat_new_stream(ctx->formatContext_dst, ctx->codec_audio);
+  if (!ctx->st_audio) {
+    LOGI(LOG_LEVEL, "Could not allocate audio stream\n");
+    return -1;
+  }
+  ctx->st_audio->id = ctx->audioStreamIndex;
+  c = ctx->st_audio->codec;
+  avcodec_get_context_defaults3(c, ctx->codec_audio);
+  c->codec_type = AVMEDIA_TYPE_AUDIO;
+  c->sample_fmt = ctx->audioSampleFmt;
+  c->sample_rate = ctx->audioSampleRate;
+  c->channel_layout = ctx->audioChannelLayout;
+  c->channels = av_get_channel_layout_nb_channels(ctx->audioChannelLayout);
+  c->bit_rate = 64000 * c->channels;
+  c->time_base.num = 1;
+  c->time_base.den = ctx->audioSampleRate;
+  /* the native AAC encoder is still experimental */
+  c->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+  if (ctx->formatContext_dst->oformat->flags & AVFMT_GLOBALHEADER) {
+    c->flags |= CODEC_FLAG_GLOBAL_HEADER;
+  }
+  if (avcodec_open2(c, ctx->codec_audio, NULL) < 0) {
+    LOGI(LOG_LEVEL, "Could not open audio codec %s\n", ctx->codec_audio->name);
+    return -1;
+  }
+  ctx->st_audio->time_base = c->time_base;
+  return 0;
+}
+
+/* adds the output stream with the codec headers of the first worker's
+ * encoder; all workers were configured alike */
+int openOutput(ReverseContext *ctx, const char* OUT_FMT_FILE) {
+  AVDictionary *muxOptions = NULL;
+  int err;
+  ctx->st_dst = avformat_new_stream(ctx->formatContext_dst, NULL);
+  if (!ctx->st_dst) {
+    LOGI(LOG_LEVEL, "Could not allocate stream\n");
+    return -1;
+  }
+  ctx->st_dst->id = ctx->stream_index;
+  if (avcodec_copy_context(ctx->st_dst->codec, ctx->streamCopy
+                               ? ctx->st_src->codec
+                               : ctx->workers[0].codecContext_dst) < 0) {
+    LOGI(LOG_LEVEL, "Could not copy encoder parameters\n");
+    return -1;
+  }
+  if (ctx->streamCopy) {
+    /* the source tag may mean nothing in this container */
+    ctx->st_dst->codec->codec_tag = 0;
+    ctx->st_dst->codec->time_base = av_inv_q(ctx->frameRate);
+    ctx->st_dst->sample_aspect_ratio = ctx->st_src->sample_aspect_ratio;
+    if (ctx->formatContext_dst->oformat->flags & AVFMT_GLOBALHEADER) {
+      ctx->st_dst->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+    }
+  }
+  if (ctx->sourceTiming) {
+    /* the timestamps muxed are the source's */
+    ctx->st_dst->codec->time_base = ctx->st_src->time_base;
+  }
+  ctx->st_dst->time_base = ctx->st_dst->codec->time_base;
+  if (ctx->audioStreamIndex >= 0 && openAudioOutput(ctx) < 0) {
+    return -1;
+  }
+  /* open the output file, if needed */
+  if (!(ctx->formatContext_dst->oformat->flags & AVFMT_NOFILE)) {
+    if (avio_open(&ctx->formatContext_dst->pb, OUT_FMT_FILE,
+                  AVIO_FLAG_WRITE) < 0) {
+      LOGI(LOG_LEVEL, "[output]Could not open '%s'\n", OUT_FMT_FILE);
+      return -1;
+    }
+  }
+  if (ctx->progressive) {
+    /* an empty moov up front, then a fragment whenever a piece is muxed */
+    av_dict_set(&muxOptions, "movflags", "empty_moov+frag_custom", 0);
+  }
+  /* Write the stream header, if any. */
+  err = avformat_write_header(ctx->formatContext_dst, &muxOptions);
+  av_dict_free(&muxOptions);
+  if (err < 0) {
+    LOGI(LOG_LEVEL, "[output]Error occurred when opening output file\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* the pieces the worker writes; with progressive output the muxer lists
+ * them all before they are written */
+int workerPieceCount(const ReverseWorker *worker) {
+  return worker->ctx->progressive ? worker->plannedPieces : worker->pieceCount;
+}
+
+/* Lists the pieces in output order: with boomerang the forward pieces
+ * first worker first, each worker's last written first, then the reversed
+ * ones last worker first in the order they were written. */
+ChunkPiece **orderPieces(ReverseContext *ctx, int *count) {
+  ChunkPiece **order;
+  int i, j, total = 0;
+  for (i = 0; i < ctx->workerCount; i++) {
+    total += workerPieceCount(&ctx->workers[i]);
+  }
+  order = (ChunkPiece**)av_malloc(FFMAX(total, 1) * sizeof(ChunkPiece*));
+  if (!order) {
+    return NULL;
+  }
+  *count = 0;
+  for (i = 0; i < ctx->workerCount; i++) {
+    ReverseWorker *worker = &ctx->workers[i];
+    for (j = workerPieceCount(worker) - 1; j >= 0; j--) {
+      if (worker->pieces[j].forward) {
+        order[(*count)++] = &worker->pieces[j];
+      }
+    }
+  }
+  for (i = ctx->workerCount - 1; i >= 0; i--) {
+    ReverseWorker *worker = &ctx->workers[i];
+    for (j = 0; j < workerPieceCount(worker); j++) {
+      if (!worker->pieces[j].forward) {
+        order[(*count)++] = &worker->pieces[j];
+      }
+    }
+  }
+  return order;
+}
+
+/* read position in the chunk pieces, see orderPieces() */
+typedef struct ChunkReader {
+  ChunkPiece **pieces;
+  int pieceCount;
+  int piece;
+  int started;
+  int firstPacket;
+  int64_t offset;
+  int64_t lastDts;
+  /* output time the last piece read ends at */
+  int64_t pieceEnd;
+} ChunkReader;
+
+/* readChunkPacket() at the end of a piece with progressive output */
+#define CHUNK_PIECE_END 2
+
+/* Progressive output: blocks until the worker has the piece on disk.
+ * Returns -1 when the worker stopped without writing it. */
+int waitForPiece(ReverseContext *ctx, const ChunkPiece *piece) {
+  ReverseWorker *worker;
+  int64_t start;
+  int index, ret;
+  if (!ctx->progressive) {
+    return 0;
+  }
+  start = av_gettime();
+  pthread_mutex_lock(&ctx->mutexPieces);
+  worker = piece->worker;
+  index = (int) (piece - worker->pieces);
+  while (worker->completedPieces <= index && !worker->finished) {
+    pthread_cond_wait(&ctx->condPieces, &ctx->mutexPieces);
+  }
+  ret = worker->completedPieces > index ? 0 : -1;
+  pthread_mutex_unlock(&ctx->mutexPieces);
+  ctx->pieceWaitTime += av_gettime() - start;
+  return ret;
+}
+
+/* Source timing: the output timestamp kept for the frame a packet of the
+ * piece counts as pos (from the piece's first frame); before the first
+ * frame, the dts of an encoder with B-frames, that one's less pos ticks. */
+int64_t pieceTimestamp(const ChunkPiece *piece, int64_t pos) {
+  const FrameTiming *timings = piece->worker->outTimings + piece->startPts;
+  if (pos == AV_NOPTS_VALUE || piece->frames <= 0) {
+    return pos;
+  }
+  if (pos < 0) {
+    return timings[0].pts + pos;
+  }
+  return timings[FFMIN(pos, piece->frames - 1)].pts;
+}
+
+/* output time the piece read last ends at, in readChunkPacket()'s time
+ * base */
+int64_t pieceEndTimestamp(ReverseContext *ctx, const ChunkReader *reader,
+                          const ChunkPiece *piece) {
+  if (ctx->sourceTiming && piece->frames > 0) {
+    const FrameTiming *last =
+        &piece->worker->outTimings[piece->startPts + piece->frames - 1];
+    return last->pts + last->duration;
+  }
+  return reader->offset + piece->frames;
+}
+
+/* Reads the next video packet. Each piece's timestamps are moved past the
+ * frames of the pieces before it; a piece whose first dts would not follow
+ * the previous one is pushed back a little further. With source timing the
+ * frames get the timestamps kept for them instead, a dts only moved where
+ * it would not follow the one before. Returns 1 with pkt in the encoder
+ * time base (the source's with source timing), CHUNK_PIECE_END after
+ * each piece with progressive output, 0 at the end, -1 on error. */
+int readChunkPacket(ReverseContext *ctx, ChunkReader *reader, AVPacket *pkt) {
+  ChunkPacketHeader header;
+  ChunkPiece *piece = NULL;
+  FILE *chunk = NULL;
+  while (reader->piece < reader->pieceCount) {
+    piece = reader->pieces[reader->piece];
+    if (!reader->started && waitForPiece(ctx, piece) < 0) {
+      return -1;
+    }
+    chunk = piece->worker->muxChunk;
+    if (!reader->started) {
+      if (fseeko(chunk, piece->offset, SEEK_SET) < 0) {
+        LOGI(LOG_LEVEL, "[output] seek chunk failed: %s\n", strerror(errno));
+        return -1;
+      }
+      reader->started = 1;
+      reader->firstPacket = 1;
+    }
+    if (ftello(chunk) < piece->end &&
+        fread(&header, sizeof(header), 1, chunk) == 1) {
+      break;
+    }
+    reader->pieceEnd = pieceEndTimestamp(ctx, reader, piece);
+    reader->offset += piece->frames;
+    reader->piece++;
+    reader->started = 0;
+    if (ctx->progressive) {
+      return CHUNK_PIECE_END;
+    }
+  }
+  if (reader->piece >= reader->pieceCount) {
+    return 0;
+  }
+  /* timestamps from the start of the piece */
+  if (header.pts != AV_NOPTS_VALUE) {
+    header.pts -= piece->startPts;
+  }
+  if (header.dts != AV_NOPTS_VALUE) {
+    header.dts -= piece->startPts;
+  }
+  if (header.size < 0 || av_new_packet(pkt, header.size) < 0) {
+    LOGI(LOG_LEVEL, "[output] bad chunk packet\n");
+    return -1;
+  }
+  if (fread(pkt->data, 1, header.size, chunk) != (size_t) header.size) {
+    LOGI(LOG_LEVEL, "[output] truncated chunk %d\n", piece->worker->index);
+    av_free_packet(pkt);
+    return -1;
+  }
+  if (ctx->sourceTiming) {
+    pkt->pts = pieceTimestamp(piece, header.pts);
+    pkt->dts = pieceTimestamp(piece, header.dts);
+    if (header.pts >= 0 && header.pts < piece->frames) {
+      pkt->duration =
+          (int) piece->worker->outTimings[piece->startPts + header.pts].duration;
+    }
+    if (pkt->dts != AV_NOPTS_VALUE && reader->lastDts != AV_NOPTS_VALUE &&
+        pkt->dts <= reader->lastDts) {
+      pkt->dts = reader->lastDts + 1;
+    }
+    if (pkt->pts != AV_NOPTS_VALUE && pkt->dts != AV_NOPTS_VALUE) {
+      pkt->pts = FFMAX(pkt->pts, pkt->dts);
+    }
+  } else {
+    if (reader->firstPacket && header.dts != AV_NOPTS_VALUE &&
+        reader->lastDts != AV_NOPTS_VALUE &&
+        header.dts + reader->offset <= reader->lastDts) {
+      reader->offset = reader->lastDts + 1 - header.dts;
+    }
+    pkt->pts = header.pts != AV_NOPTS_VALUE ? header.pts + reader->offset
+                                            : AV_NOPTS_VALUE;
+    pkt->dts = header.dts != AV_NOPTS_VALUE ? header.dts + reader->offset
+                                            : AV_NOPTS_VALUE;
+  }
+  reader->firstPacket = 0;
+  if (pkt->dts != AV_NOPTS_VALUE) {
+    reader->lastDts = pkt->dts;
+  }
+  pkt->flags = header.flags;
+  return 1;
+}
+
+/* PCM of the chunk pieces, fed to the audio encoder */
+typedef struct AudioMux {
+  ChunkPiece **pieces;
+  int pieceCount;
+  int piece;
+  int started;
+  int64_t left;
+  AVFrame *frame;
+  uint8_t *samples;
+  int frameSize;
+  int64_t pts;
+  int draining;
+} AudioMux;
+
+int initAudioMux(ReverseContext *ctx, AudioMux *mux, ChunkPiece **pieces,
+                 int pieceCount) {
+  AVCodecContext *c = ctx->st_audio->codec;
+  memset(mux, 0, sizeof(*mux));
+  mux->pieces = pieces;
+  mux->pieceCount = pieceCount;
+  mux->frameSize = c->frame_size > 0 ? c->frame_size : 1024;
+  mux->frame = avcodec_alloc_frame();
+  mux->samples = av_malloc(mux->frameSize * ctx->audioSampleSize);
+  return mux->frame && mux->samples ? 0 : -1;
+}
+
+void freeAudioMux(AudioMux *mux) {
+  av_freep(&mux->frame);
+  av_freep(&mux->samples);
+}
+
+int readPcmSamples(ReverseContext *ctx, AudioMux *mux, int count) {
+  int got = 0;
+  while (got < count && mux->piece < mux->pieceCount) {
+    ChunkPiece *piece = mux->pieces[mux->piece];
+    FILE *chunk;
+    int want, read;
+    if (!mux->started && waitForPiece(ctx, piece) < 0) {
+      break;
+    }
+    chunk = piece->worker->muxPcmChunk;
+    if (!mux->started) {
+      if (fseeko(chunk, (off_t) piece->pcmOffset * ctx->audioSampleSize,
+                 SEEK_SET) < 0) {
+        break;
+      }
+      mux->left = piece->samples;
+      mux->started = 1;
+    }
+    want = (int) FFMIN(count - got, mux->left);
+    read = fread(mux->samples + got * ctx->audioSampleSize,
+                 ctx->audioSampleSize, want, chunk);
+    got += read;
+    mux->left -= read;
+    if (read < want || mux->left == 0) {
+      mux->piece++;
+      mux->started = 0;
+    }
+  }
+  return got;
+}
+
+/* Encodes the next frame of reversed PCM and drains the encoder once the
+ * chunks are exhausted. Returns 0 when the audio stream is complete. */
+int writeAudioFrame(ReverseContext *ctx, AudioMux *mux) {
+  AVCodecContext *c = ctx->st_audio->codec;
+  AVPacket pkt;
+  int got_output = 0;
+  int err = 0;
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  if (!mux->draining) {
+    int count = readPcmSamples(ctx, mux, mux->frameSize);
+    if (count == 0) {
+      mux->draining = 1;
+    } else {
+      if (count < mux->frameSize &&
+          !(c->codec->capabilities & CODEC_CAP_SMALL_LAST_FRAME)) {
+        av_samples_set_silence(&mux->samples, count, mux->frameSize - count,
+                               c->channels, c->sample_fmt);
+        count = mux->frameSize;
+      }
+      mux->frame->nb_samples = count;
+      avcodec_fill_audio_frame(mux->frame, c->channels, c->sample_fmt,
+                               mux->samples, count * ctx->audioSampleSize, 1);
+      mux->frame->pts = mux->pts;
+      mux->pts += count;
+      err = avcodec_encode_audio2(c, &pkt, mux->frame, &got_output);
+    }
+  }
+  if (mux->draining) {
+    if (!(c->codec->capabilities & CODEC_CAP_DELAY)) {
+      return 0;
+    }
+    err = avcodec_encode_audio2(c, &pkt, NULL, &got_output);
+    if (err >= 0 && !got_output) {
+      return 0;
+    }
+  }
+  if (err < 0) {
+    LOGI(LOG_LEVEL, "Error encoding audio frame\n");
+    return -1;
+  }
+  if (got_output) {
+    pkt.pts = av_rescale_q(pkt.pts, c->time_base, ctx->st_audio->time_base);
+    pkt.dts = av_rescale_q(pkt.dts, c->time_base, ctx->st_audio->time_base);
+    pkt.duration = av_rescale_q(pkt.duration, c->time_base,
+                                ctx->st_audio->time_base);
+    pkt.stream_index = ctx->st_audio->index;
+    err = av_interleaved_write_frame(ctx->formatContext_dst, &pkt);
+    av_free_packet(&pkt);
+    if (err < 0) {
+      LOGI(LOG_LEVEL, "[output] write audio frame failed: %d \n", err);
+      return -1;
+    }
+    ctx->fragmentPackets++;
+  }
+  return 1;
+}
+
+/* Progressive output: writes out the fragment muxed so far and reports it.
+ * The last one is written by the trailer, only reported here. */
+int flushFragment(ReverseContext *ctx, int last) {
+  AVFormatContext *fc = ctx->formatContext_dst;
+  ReverseFragment fragment;
+  int64_t pos;
+  if (!last) {
+    if (ctx->fragmentPackets == 0) {
+      return 0;
+    }
+    /* the packets the interleaver holds back belong to it too */
+    if (av_interleaved_write_frame(fc, NULL) < 0 ||
+        av_write_frame(fc, NULL) < 0) {
+      LOGI(LOG_LEVEL, "[output] Could not write fragment %d\n",
+           ctx->fragmentIndex);
+      return -1;
+    }
+  }
+  avio_flush(fc->pb);
+  pos = avio_tell(fc->pb);
+  fragment.index = ctx->fragmentIndex;
+  fragment.offset = ctx->fragmentOffset;
+  fragment.size = pos - ctx->fragmentOffset;
+  fragment.endUs = ctx->fragmentEnd;
+  fragment.last = last;
+  LOGI(LOG_LEVEL, "fragment %d: %"PRId64" bytes at %"PRId64", up to %.3f s\n",
+       fragment.index, fragment.size, fragment.offset,
+       fragment.endUs / 1000000.0);
+  if (ctx->fragmentCallback) {
+    ctx->fragmentCallback(ctx->fragmentOpaque, &fragment);
+  }
+  ctx->fragmentIndex++;
+  ctx->fragmentOffset = pos;
+  ctx->fragmentPackets = 0;
+  return 0;
+}
+
+/* Muxes the chunk pieces into the output in the order orderPieces() put
+ * them, encoding the audio alongside so both streams are interleaved as
+ * they are written. With progressive output each piece but the last ends
+ * a fragment, the audio up to its end included. */
+int concatenateChunks(ReverseContext *ctx, ChunkPiece **pieces,
+                      int pieceCount) {
+  AVRational tb = ctx->sourceTiming ? ctx->st_src->time_base
+                                     : ctx->st_dst->codec->time_base;
+  ChunkReader reader = {NULL, 0, 0, 0, 1, 0, AV_NOPTS_VALUE, 0};
+  AudioMux audio;
+  AVPacket pkt;
+  int hasAudio = ctx->st_audio != NULL;
+  int audioOpen = hasAudio;
+  int hasVideo, err = 0;
+  reader.pieces = pieces;
+  reader.pieceCount = pieceCount;
+  if (hasAudio && initAudioMux(ctx, &audio, pieces, pieceCount) < 0) {
+    freeAudioMux(&audio);
+    return -1;
+  }
+  hasVideo = readChunkPacket(ctx, &reader, &pkt);
+  while (hasVideo > 0 || hasAudio > 0) {
+    if (isCancelled(ctx)) {
+      if (hasVideo == 1) {
+        av_free_packet(&pkt);
+      }
+      hasVideo = -1;
+      break;
+    }
+    if (hasVideo == CHUNK_PIECE_END) {
+      if (hasAudio > 0 &&
+          av_compare_ts(audio.pts + audio.frameSize,
+                        ctx->st_audio->codec->time_base,
+                        reader.pieceEnd, tb) <= 0) {
+        hasAudio = writeAudioFrame(ctx, &audio);
+        continue;
+      }
+      ctx->fragmentEnd = av_rescale_q(reader.pieceEnd, tb, AV_TIME_BASE_Q);
+      if (reader.piece < reader.pieceCount && flushFragment(ctx, 0) < 0) {
+        hasVideo = -1;
+        break;
+      }
+      hasVideo = readChunkPacket(ctx, &reader, &pkt);
+      continue;
+    }
+    if (hasAudio > 0 &&
+        (hasVideo <= 0 ||
+         av_compare_ts(audio.pts, ctx->st_audio->codec->time_base,
+                       pkt.dts != AV_NOPTS_VALUE ? pkt.dts : pkt.pts, tb) <= 0)) {
+      hasAudio = writeAudioFrame(ctx, &audio);
+      continue;
+    }
+    pkt.pts = av_rescale_q(pkt.pts, tb, ctx->st_dst->time_base);
+    pkt.dts = av_rescale_q(pkt.dts, tb, ctx->st_dst->time_base);
+    pkt.duration = (int) av_rescale_q(pkt.duration, tb,
+                                      ctx->st_dst->time_base);
+    pkt.stream_index = ctx->st_dst->index;
+    err = av_interleaved_write_frame(ctx->formatContext_dst, &pkt);
+    av_free_packet(&pkt);
+    if (err < 0) {
+      LOGI(LOG_LEVEL, "[output] write frame failed: %d \n", err);
+      hasVideo = -1;
+      break;
+    }
+    ctx->fragmentPackets++;
+    hasVideo = readChunkPacket(ctx, &reader, &pkt);
+  }
+  if (audioOpen) {
+    freeAudioMux(&audio);
+  }
+  return hasVideo < 0 || hasAudio < 0 ? -1 : 0;
+}
+
+int writeTrailer(ReverseContext *ctx) {
+  av_write_trailer(ctx->formatContext_dst);
+  LOGI(LOG_LEVEL, "Encoding video frame DONE!\n");
+  return 0;
+}
+
+void closeEncodeEnvironment(ReverseContext *ctx) {
+  if (ctx->st_audio && ctx->st_audio->codec) {
+    avcodec_close(ctx->st_audio->codec);
+  }
+  ctx->st_audio = NULL;
+  if (ctx->formatContext_dst) {
+    if (ctx->formatContext_dst->pb &&
+        !(ctx->formatContext_dst->oformat->flags & AVFMT_NOFILE)) {
+      avio_close(ctx->formatContext_dst->pb);
+    }
+    avformat_free_context(ctx->formatContext_dst);
+    ctx->formatContext_dst = NULL;
+  }
+  ctx->st_dst = NULL;
+}
+
+void closeDecodeEnvironment(ReverseContext *ctx) {
+  if (ctx->formatContext_src) {
+    avformat_close_input(&ctx->formatContext_src);
+  }
+  ctx->st_src = NULL;
+}
+
+/* stage times are per thread, summed over the workers */
+void addWorkerStats(ReverseStats *stats, const ReverseWorker *worker) {
+  stats->frames += worker->encodeFramePos - worker->resumedFrames;
+  stats->decodedFrames += worker->decodedFrames;
+  stats->demuxUs += worker->demuxTime;
+  stats->decodeUs += worker->decodeTime;
+  stats->copyUs += worker->copyTime;
+  stats->convertUs += worker->convertTime;
+  stats->encodeUs += worker->encodeTime;
+  stats->audioUs += worker->audioTime;
+}
+
+/* What a checkpoint is only valid for: the source file as it was, the
+ * arguments and options, and the segment plan and its split between the
+ * workers. NULL when the source is not a local file. */
+char *jobHeader(ReverseContext *ctx, const char* SRC_FILE,
+                const char* OUT_FMT_FILE) {
+  AVDictionaryEntry *entry = NULL;
+  struct stat st;
+  AVBPrint header;
+  char *text = NULL;
+  int i;
+  if (stat(SRC_FILE, &st) < 0) {
+    return NULL;
+  }
+  av_bprint_init(&header, 0, AV_BPRINT_SIZE_UNLIMITED);
+  av_bprintf(&header, "reverse job 1\nsource %s\nsize %"PRId64" mtime %ld\n",
+             SRC_FILE, (int64_t) st.st_size, (long) st.st_mtime);
+  av_bprintf(&header, "output %s\nrange %"PRId64" %"PRId64" audio %d\n",
+             OUT_FMT_FILE, ctx->rangeStartUs, ctx->rangeEndUs,
+             ctx->audioStreamIndex);
+  while ((entry = av_dict_get(ctx->options, "", entry,
+                              AV_DICT_IGNORE_SUFFIX))) {
+    av_bprintf(&header, "option %s=%s\n", entry->key, entry->value);
+  }
+  av_bprintf(&header, "frames %d segments %d workers %d\n", ctx->frameCount,
+             ctx->segmentCount, ctx->workerCount);
+  for (i = 0; i < ctx->segmentCount; i++) {
+    const ReverseSegment *segment = &ctx->segments[i];
+    av_bprintf(&header, "segment %d %d %d %"PRId64" %d\n",
+               segment->startFramePos, segment->endFramePos,
+               segment->seekFramePos, segment->seekTimestamp, segment->spill);
+  }
+  for (i = 0; i < ctx->workerCount; i++) {
+    av_bprintf(&header, "worker %d %d\n", ctx->workers[i].firstSegment,
+               ctx->workers[i].lastSegment);
+  }
+  av_bprintf(&header, "pieces\n");
+  if (av_bprint_finalize(&header, &text) < 0) {
+    return NULL;
+  }
+  return text;
+}
+
+/* cuts a chunk back to what its restored pieces hold */
+int truncateChunk(FILE *chunk, off_t size) {
+  if (fflush(chunk) != 0 || ftruncate(fileno(chunk), size) < 0 ||
+      fseeko(chunk, size, SEEK_SET) < 0) {
+    LOGI(LOG_LEVEL, "Could not truncate chunk: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* the job is done, nothing of it has to survive */
+void removeJobFiles(ReverseContext *ctx, const char* OUT_FMT_FILE) {
+  static const char *kinds[] = {"chunk", "pcm"};
+  int i, k;
+  for (i = 0; i < ctx->workerCount; i++) {
+    for (k = 0; k < 2; k++) {
+      char *path = scratchFilePath(ctx, OUT_FMT_FILE, kinds[k], i);
+      if (path) {
+        unlink(path);
+        av_free(path);
+      }
+    }
+  }
+  job_manifest_close(&ctx->manifest, 1);
+}
+
+/* Source timing of a piece restored from the checkpoint: its frames are
+ * its segment's, forward or reversed, as planned. */
+int restorePieceTimings(ReverseWorker *worker, const ChunkPiece *piece) {
+  ReverseContext *ctx = worker->ctx;
+  const ReverseSegment *segment = &ctx->segments[piece->segment];
+  int i;
+  for (i = 0; i < piece->frames; i++) {
+    int pos = piece->forward ? segment->startFramePos + i
+                             : segment->endFramePos - i;
+    FrameTiming timing = getFrameTiming(ctx, pos, AV_NOPTS_VALUE);
+    if (setOutputTiming(worker, (int) piece->startPts + i, &timing,
+                        piece->forward) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Opens the job manifest and, when it belongs to this very job, takes the
+ * segments it records as done: their pieces are restored, the chunks cut
+ * back to their end and every worker starts below the segments it already
+ * did (workers go from their last segment to their first). Anything else
+ * starts the job over. */
+int resumeJob(ReverseContext *ctx, const char* SRC_FILE,
+              const char* OUT_FMT_FILE) {
+  JobManifestPiece *records = NULL;
+  uint8_t *done = NULL;
+  char *header = jobHeader(ctx, SRC_FILE, OUT_FMT_FILE);
+  char *path = av_asprintf("%s.job", ctx->scratchPath ? ctx->scratchPath
+                                                     : OUT_FMT_FILE);
+  int count = -1, resumed = 0, ret = 0, i, w;
+  if (header && path) {
+    count = job_manifest_open(&ctx->manifest, path, header, &records);
+  }
+  av_free(header);
+  av_free(path);
+  if (count < 0) {
+    LOGI(LOG_LEVEL, "Could not write the job manifest, no checkpoints\n");
+    removeJobFiles(ctx, OUT_FMT_FILE);
+    ctx->checkpoint = 0;
+    return 0;
+  }
+  done = av_mallocz(FFMAX(ctx->segmentCount, 1));
+  if (!done) {
+    av_free(records);
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    if (!records[i].forward && records[i].segment >= 0 &&
+        records[i].segment < ctx->segmentCount) {
+      done[records[i].segment] = 1;
+    }
+  }
+  for (w = 0; w < ctx->workerCount && ret == 0; w++) {
+    ReverseWorker *worker = &ctx->workers[w];
+    int last = worker->lastSegment;
+    while (last >= worker->firstSegment && done[last]) {
+      last--;
+    }
+    for (i = 0; i < count && ret == 0; i++) {
+      JobManifestPiece *record = &records[i];
+      ChunkPiece *piece;
+      if (record->worker != w || record->segment <= last ||
+          record->segment > worker->lastSegment) {
+        continue;
+      }
+      ret = beginPiece(worker, record->forward, record->segment);
+      if (ret < 0) {
+        break;
+      }
+      piece = &worker->pieces[worker->pieceCount - 1];
+      piece->startPts = record->startPts;
+      piece->frames = record->frames;
+      piece->offset = record->offset;
+      piece->end = record->end;
+      piece->pcmOffset = record->pcmOffset;
+      piece->samples = record->samples;
+      if (ctx->sourceTiming && restorePieceTimings(worker, piece) < 0) {
+        ret = -1;
+      }
+      worker->pieceCursor = worker->pieceCount;
+      worker->encodeFramePos = (int) (piece->startPts + piece->frames);
+      worker->pcmSamples = piece->pcmOffset + piece->samples;
+      worker->resumedFrames += piece->frames;
+    }
+    worker->forceKeyframe = 0;
+    resumed += worker->lastSegment - last;
+    worker->lastSegment = last;
+    if (ret == 0 &&
+        (truncateChunk(worker->chunk, worker->pieceCount > 0
+                       ? worker->pieces[worker->pieceCount - 1].end : 0) < 0 ||
+         (worker->pcmChunk &&
+          truncateChunk(worker->pcmChunk,
+                        (off_t) worker->pcmSamples * ctx->audioSampleSize) < 0))) {
+      ret = -1;
+    }
+  }
+  if (resumed > 0) {
+    LOGI(LOG_LEVEL, "resuming the job: %d of %d segments done\n", resumed,
+         ctx->segmentCount);
+  }
+  av_free(records);
+  av_free(done);
+  return ret;
+}
+
+/* Progressive output: lists the pieces the worker is going to write, in
+ * the order it writes them, after those restored from the checkpoint, so
+ * the muxer can order them all before they exist. A piece per segment,
+ * two with boomerang, which does without the frame cache that may split
+ * segments. The frame timings the muxer reads are not moved meanwhile
+ * either. */
+int reservePieces(ReverseWorker *worker) {
+  ReverseContext *ctx = worker->ctx;
+  int perSegment = ctx->boomerang ? 2 : 1;
+  int count = worker->pieceCount +
+              (worker->lastSegment - worker->firstSegment + 1) * perSegment;
+  int frames = worker->encodeFramePos;
+  ChunkPiece *pieces;
+  int i, n = worker->pieceCount;
+  for (i = worker->firstSegment; i <= worker->lastSegment; i++) {
+    frames += (ctx->segments[i].endFramePos -
+               ctx->segments[i].startFramePos + 1) * perSegment;
+  }
+  if (ctx->sourceTiming) {
+    FrameTiming *timings = (FrameTiming*)av_fast_realloc(
+        worker->outTimings, &worker->outTimingsSize,
+        FFMAX(frames, 1) * sizeof(FrameTiming));
+    if (!timings) {
+      return -1;
+    }
+    worker->outTimings = timings;
+  }
+  pieces = av_realloc(worker->pieces, FFMAX(count, 1) * sizeof(ChunkPiece));
+  if (!pieces) {
+    return -1;
+  }
+  worker->pieces = pieces;
+  memset(pieces + n, 0, (count - n) * sizeof(ChunkPiece));
+  for (i = worker->lastSegment; i >= worker->firstSegment; i--) {
+    if (ctx->boomerang) {
+      pieces[n].worker = worker;
+      pieces[n].segment = i;
+      pieces[n++].forward = 1;
+    }
+    pieces[n].worker = worker;
+    pieces[n++].segment = i;
+  }
+  worker->pieceCapacity = worker->plannedPieces = count;
+  worker->completedPieces = worker->pieceCursor;
+  return 0;
+}
+
+int decode2YUV2Video(ReverseContext *ctx, const char* SRC_FILE,
+                     const char* OUT_FMT_FILE) {
+  int i, started, spillWindow, spillCount, renderedFrames = 0;
+  int64_t startTime, elapsed;
+  ChunkPiece **order = NULL;
+  int orderCount = 0, muxRet = 0;
+  int ret;
+  size_t slotSize;
+  ret = initDecodeEnvironmentAndGetVideoFrameCount(ctx, SRC_FILE);
+  if (ret < 0) {
+    LOGI(LOG_LEVEL, "initDecodeEnvironmentAndGetVideoFrameCount error.\n");
+    goto end;
+  }
+  if (ctx->frameCount <= 0) {
+    goto end;
+  }
+  ctx->width = ctx->st_src->codec->width;
+  ctx->height = ctx->st_src->codec->height;
+  choosePreviewSize(ctx);
+  slotSize = frame_pool_slot_size(ctx->width, ctx->height, STREAM_PIX_FMT);
+  if (slotSize == 0) {
+    LOGI(LOG_LEVEL, "Unsupported frame size %dx%d\n", ctx->width, ctx->height);
+    ret = -1;
+    goto end;
+  }
+
+  //initYUVEncodeEnvironment();
+  ret = initH263EncodeEnvironment(ctx, OUT_FMT_FILE);
+  if (ret < 0) {
+    LOGI(LOG_LEVEL, "initH263EncodeEnvironment error.\n");
+    goto end;
+  }
+  ctx->progressive = useProgressiveOutput(ctx);
+  ctx->streamCopy = canStreamCopy(ctx);
+  ctx->directRender = canRenderDirect(ctx);
+  ctx->frameRate = chooseFrameRate(ctx);
+  ctx->sourceTiming = useSourceTiming(ctx);
+  if (ctx->sourceTiming) {
+    ctx->rangeStartPts = getFramePts(ctx, ctx->rangeStartPos);
+    ctx->rangeEndPts = getFramePts(ctx, ctx->rangeEndPos + 1);
+  }
+  LOGI(LOG_LEVEL, "encoder %s, %d/%d fps, %s timing\n",
+       ctx->streamCopy ? "copy" : ctx->codec_dst->name,
+       ctx->frameRate.num, ctx->frameRate.den,
+       ctx->sourceTiming ? "source" : "constant");
+  ret = initAudioEncodeEnvironment(ctx);
+  if (ret < 0) {
+    goto end;
+  }
+  ctx->workerCount = chooseWorkerCount(ctx, slotSize);
+  spillWindow = computeSegmentFrames(ctx, slotSize);
+  capSegmentFrames(ctx);
+  /* copied packets are small, they never need the spill file */
+  ret = spillCount = planSegments(ctx, spillWindow > 0 && !ctx->streamCopy);
+  if (ret < 0) {
+    LOGI(LOG_LEVEL, "planSegments error.\n");
+    goto end;
+  }
+  ret = allocWorkers(ctx, FFMIN(ctx->workerCount, ctx->segmentCount));
+  if (ret < 0) {
+    goto end;
+  }
+  assignWorkerSegments(ctx);
+  for (i = 0; i < ctx->workerCount; i++) {
+    ret = initWorker(&ctx->workers[i], SRC_FILE, OUT_FMT_FILE);
+    if (ret < 0) {
+      goto end;
+    }
+  }
+  for (i = 0; spillCount > 0 && i < ctx->workerCount; i++) {
+    if (openSpillFiles(&ctx->workers[i], OUT_FMT_FILE, spillWindow) < 0) {
+      /* no scratch space, re-decode long GOPs in pool-sized parts instead */
+      ret = planSegments(ctx, 0);
+      if (ret < 0) {
+        goto end;
+      }
+      assignWorkerSegments(ctx);
+      break;
+    }
+  }
+  if (ctx->checkpoint && resumeJob(ctx, SRC_FILE, OUT_FMT_FILE) < 0) {
+    ret = -1;
+    goto end;
+  }
+  ctx->segmentPieces = ctx->boomerang || ctx->checkpoint || ctx->progressive;
+  if (ctx->progressive) {
+    /* the output is muxed as the pieces come, in an order fixed now */
+    for (i = 0; i < ctx->workerCount; i++) {
+      if (reservePieces(&ctx->workers[i]) < 0) {
+        ret = -1;
+        goto end;
+      }
+    }
+    order = orderPieces(ctx, &orderCount);
+    if (!order || openOutput(ctx, OUT_FMT_FILE) < 0) {
+      ret = -1;
+      goto end;
+    }
+  }
+  startTime = av_gettime();
+  for (started = 0; started < ctx->workerCount; started++) {
+    ret = pthread_create(&ctx->workers[started].thread, NULL,
+                         ctx->progressive ? runProgressiveWorker : runWorker,
+                         &ctx->workers[started]);
+    if (ret != 0) {
+      LOGI(LOG_LEVEL, "Could not create worker thread: %d\n", ret);
+      break;
+    }
+  }
+  if (ctx->progressive && ret == 0) {
+    /* on failure the workers are left to finish, they are joined below */
+    muxRet = concatenateChunks(ctx, order, orderCount);
+    ctx->stats.muxUs = av_gettime() - startTime - ctx->pieceWaitTime;
+  }
+  /* the workers already started still have to be joined */
+  for (i = 0; i < started; i++) {
+    pthread_join(ctx->workers[i].thread, NULL);
+    if (ctx->workers[i].ret < 0) {
+      ret = -1;
+    }
+    ctx->encodedFrames += ctx->workers[i].encodeFramePos -
+                          ctx->workers[i].resumedFrames;
+    renderedFrames += ctx->workers[i].renderedFrames;
+    addWorkerStats(&ctx->stats, &ctx->workers[i]);
+  }
+  elapsed = av_gettime() - startTime;
+  ctx->encodeFps = elapsed > 0 ? ctx->encodedFrames * 1000000.0 / elapsed : 0;
+  LOGI(LOG_LEVEL, "encoded %d frames in %.2f s: %.1f fps\n", ctx->encodedFrames,
+       elapsed / 1000000.0, ctx->encodeFps);
+  LOGI(LOG_LEVEL, "decoded %d frames, %.2f per frame\n",
+       ctx->stats.decodedFrames, ctx->encodedFrames > 0
+       ? (double) ctx->stats.decodedFrames / ctx->encodedFrames : 0.0);
+  if (ctx->directRender) {
+    LOGI(LOG_LEVEL, "%d frames stored where the decoders rendered them\n",
+         renderedFrames);
+  }
+  if (ret != 0 || muxRet < 0) {
+    ret = -1;
+    goto end;
+  }
+  startTime = av_gettime();
+  if (!ctx->progressive) {
+    order = orderPieces(ctx, &orderCount);
+    if (!order || openOutput(ctx, OUT_FMT_FILE) < 0 ||
+        concatenateChunks(ctx, order, orderCount) < 0) {
+      ret = -1;
+      goto end;
+    }
+  }
+  ret = writeTrailer(ctx);
+  ctx->stats.muxUs += av_gettime() - startTime;
+  if (ctx->progressive) {
+    flushFragment(ctx, 1);
+  }
+  if (ctx->checkpoint) {
+    removeJobFiles(ctx, OUT_FMT_FILE);
+  }
+end:
+  if (isCancelled(ctx)) {
+    LOGI(LOG_LEVEL, "reverse cancelled.\n");
+    ret = AVERROR_EXIT;
+  }
+  /* kept for the next attempt unless the job is done */
+  job_manifest_close(&ctx->manifest, 0);
+  av_free(order);
+  freeWorkers(ctx);
+  av_freep(&ctx->segments);
+  packet_index_free(&ctx->packetIndex);
+  closeEncodeEnvironment(ctx);
+  closeDecodeEnvironment(ctx);
+  return ret;
+}
+
+void readReverseOptions(ReverseContext *ctx, AVDictionary *options) {
+  AVDictionaryEntry *entry;
+  ctx->memoryBudget = 0;
+  ctx->scratchPath = NULL;
+  ctx->workerLimit = 0;
+  ctx->videoEncoderName = NULL;
+  ctx->bitRate = 0;
+  ctx->preset = NULL;
+  ctx->encoderThreads = 0;
+  ctx->lookahead = -1;
+  ctx->gopSize = 0;
+  ctx->qmin = -1;
+  ctx->qmax = -1;
+  ctx->streamCopyOption = -1;
+  ctx->frameCacheRatio = 4;
+  ctx->directRenderOption = 1;
+  ctx->timingOption = 1;
+  ctx->decoderThreads.count = 0;
+  ctx->decoderThreads.mode = DECODER_THREADS_AUTO;
+  decoder_threads_read(&ctx->decoderThreads, options);
+  if ((entry = av_dict_get(options, "memory_budget", NULL, 0))) {
+    ctx->memoryBudget = strtoll(entry->value, NULL, 10);
+  }
+  ctx->indexCacheDir = NULL;
+  if ((entry = av_dict_get(options, "index_cache", NULL, 0)) &&
+      entry->value[0]) {
+    ctx->indexCacheDir = entry->value;
+  }
+  if ((entry = av_dict_get(options, "scratch_path", NULL, 0))) {
+    ctx->scratchPath = entry->value;
+  }
+  if ((entry = av_dict_get(options, "workers", NULL, 0))) {
+    ctx->workerLimit = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "video_encoder", NULL, 0))) {
+    ctx->videoEncoderName = entry->value;
+  }
+  if ((entry = av_dict_get(options, "bitrate", NULL, 0))) {
+    ctx->bitRate = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "preset", NULL, 0))) {
+    ctx->preset = entry->value;
+  }
+  if ((entry = av_dict_get(options, "threads", NULL, 0))) {
+    ctx->encoderThreads = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "lookahead", NULL, 0))) {
+    ctx->lookahead = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "gop", NULL, 0))) {
+    ctx->gopSize = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "qmin", NULL, 0))) {
+    ctx->qmin = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "qmax", NULL, 0))) {
+    ctx->qmax = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "frame_cache", NULL, 0))) {
+    ctx->frameCache = !strcmp(entry->value, "delta");
+  }
+  if ((entry = av_dict_get(options, "frame_cache_ratio", NULL, 0))) {
+    ctx->frameCacheRatio = FFMAX(atoi(entry->value), 1);
+  }
+  if ((entry = av_dict_get(options, "preview", NULL, 0))) {
+    ctx->previewSize = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "checkpoint", NULL, 0))) {
+    ctx->checkpoint = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "timing", NULL, 0))) {
+    ctx->timingOption = strcmp(entry->value, "cfr") != 0;
+  }
+  if ((entry = av_dict_get(options, "direct_render", NULL, 0))) {
+    ctx->directRenderOption = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "boomerang", NULL, 0))) {
+    ctx->boomerang = atoi(entry->value);
+  }
+  if ((entry = av_dict_get(options, "progressive", NULL, 0))) {
+    ctx->progressive = atoi(entry->value);
+  }
+  if (ctx->boomerang && ctx->frameCache) {
+    /* cached frames can only be restored newest first */
+    LOGI(LOG_LEVEL, "frame_cache does not work with boomerang, ignored\n");
+    ctx->frameCache = 0;
+  }
+  if ((entry = av_dict_get(options, "stream_copy", NULL, 0))) {
+    ctx->streamCopyOption = strcmp(entry->value, "auto") ? atoi(entry->value)
+                                                        : -1;
+  }
+}
+
+/* Concurrent jobs open and close codecs from several threads, which
+ * libavcodec only allows with a lock manager. */
+int lockManager(void **mutex, enum AVLockOp op) {
+  switch (op) {
+  case AV_LOCK_CREATE:
+    *mutex = av_malloc(sizeof(pthread_mutex_t));
+    if (!*mutex || pthread_mutex_init((pthread_mutex_t*)*mutex, NULL) != 0) {
+      av_freep(mutex);
+      return -1;
+    }
+    return 0;
+  case AV_LOCK_OBTAIN:
+    return pthread_mutex_lock((pthread_mutex_t*)*mutex) != 0;
+  case AV_LOCK_RELEASE:
+    return pthread_mutex_unlock((pthread_mutex_t*)*mutex) != 0;
+  case AV_LOCK_DESTROY:
+    pthread_mutex_destroy((pthread_mutex_t*)*mutex);
+    av_freep(mutex);
+    return 0;
+  }
+  return -1;
+}
+
+pthread_once_t lockManagerOnce = PTHREAD_ONCE_INIT;
+
+void registerLockManager(void) {
+  av_register_all();
+  av_lockmgr_register(lockManager);
+}
+
+ReverseContext *reverse_context_create(const char *file_path_src,
+                                      const char *file_path_desc,
+                                      long positionUsStart, long positionUsEnd,
+                                      int video_stream_no, int audio_stream_no,
+                                      int subtitle_stream_no,
+                                      AVDictionary *options) {
+  ReverseContext *ctx = (ReverseContext*)av_mallocz(sizeof(ReverseContext));
+  if (!ctx) {
+    return NULL;
+  }
+  pthread_once(&lockManagerOnce, registerLockManager);
+  pthread_mutex_init(&ctx->mutexCancel, NULL);
+  pthread_mutex_init(&ctx->mutexPieces, NULL);
+  pthread_cond_init(&ctx->condPieces, NULL);
+  ctx->srcPath = av_strdup(file_path_src);
+  ctx->dstPath = av_strdup(file_path_desc);
+  if (!ctx->srcPath || !ctx->dstPath) {
+    reverse_context_destroy(ctx);
+    return NULL;
+  }
+  av_dict_copy(&ctx->options, options, 0);
+  readReverseOptions(ctx, ctx->options);
+  ctx->segmentFrames = BUFFER_LIST_SIZE;
+  ctx->rangeStartUs = positionUsStart;
+  ctx->rangeEndUs = positionUsEnd;
+  ctx->stream_index = -1;
+  ctx->audioStreamNo = audio_stream_no;
+  ctx->audioStreamIndex = -1;
+  ctx->audioSampleFmt = AV_SAMPLE_FMT_NONE;
+  ctx->rangeEndPos = -1;
+  return ctx;
+}
+
+int reverse_context_run(ReverseContext *ctx) {
+  int64_t start = av_gettime();
+  int ret;
+  LOGI(LOG_LEVEL, "reversing...");
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
+  ret = decode2YUV2Video(ctx, ctx->srcPath, ctx->dstPath);
+  ctx->stats.wallUs = av_gettime() - start;
+  return ret;
+}
+
+void reverse_context_stats(ReverseContext *ctx, ReverseStats *stats) {
+  *stats = ctx->stats;
+}
+
+double reverse_context_encode_fps(ReverseContext *ctx) {
+  return ctx->encodeFps;
+}
+
+int reverse_context_progressive(ReverseContext *ctx) {
+  return ctx->progressive;
+}
+
+void reverse_context_set_fragment_callback(ReverseContext *ctx,
+                                           ReverseFragmentCallback callback,
+                                           void *opaque) {
+  ctx->fragmentCallback = callback;
+  ctx->fragmentOpaque = opaque;
+}
+
+void reverse_context_cancel(ReverseContext *ctx) {
+  pthread_mutex_lock(&ctx->mutexCancel);
+  ctx->cancelled = 1;
+  pthread_mutex_unlock(&ctx->mutexCancel);
+}
+
+void reverse_context_destroy(ReverseContext *ctx) {
+  if (!ctx) {
+    return;
+  }
+  pthread_mutex_destroy(&ctx->mutexCancel);
+  pthread_cond_destroy(&ctx->condPieces);
+  pthread_mutex_destroy(&ctx->mutexPieces);
+  av_dict_free(&ctx->options);
+  av_freep(&ctx->srcPath);
+  av_freep(&ctx->dstPath);
+  av_free(ctx);
+}
+
+int reverse(char *file_path_src, char *file_path_desc,
+            long positionUsStart, long positionUsEnd,
+            int video_stream_no, int audio_stream_no,
+            int subtitle_stream_no, AVDictionary *options) {
+  ReverseContext *ctx;
+  int err;
+  ctx = reverse_context_create(file_path_src, file_path_desc,
+                               positionUsStart, positionUsEnd,
+                               video_stream_no, audio_stream_no,
+                               subtitle_stream_no, options);
+  if (!ctx) {
+    return AVERROR(ENOMEM);
+  }
+  err = reverse_context_run(ctx);
+  reverse_context_destroy(ctx);
+  return err;
+}
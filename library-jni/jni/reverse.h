@@ -1,18 +1,191 @@
+#ifndef REVERSE_H_
+#define REVERSE_H_
+
 #include <libavformat/avformat.h>
 #include <libavutil/avutil.h>
-#include <android/log.h>
+#include "reverse_log.h"
 
 #define FFMPEG_LOG_LEVEL AV_LOG_WARNING
 #define LOG_LEVEL 2
 #define LOG_TAG "reverse.c"
-#define LOGI(level, ...) if (level <= LOG_LEVEL) {__android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__);}
-#define LOGE(level, ...) if (level <= LOG_LEVEL + 10) {__android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__);}
-#define LOGW(level, ...) if (level <= LOG_LEVEL + 5) {__android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__);}
+#define LOGI(level, ...) if (level <= LOG_LEVEL) {reverse_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__);}
+#define LOGE(level, ...) if (level <= LOG_LEVEL + 10) {reverse_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__);}
+#define LOGW(level, ...) if (level <= LOG_LEVEL + 5) {reverse_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__);}
 
+/*
+ * Reverses the frames shown in [positionUsStart, positionUsEnd), counted
+ * from the start of the video stream; 0 leaves that side open. Only GOPs
+ * overlapping the range are demuxed and decoded, and the GOP before the
+ * first one when that one is open (its leading frames reference it); the
+ * output starts at timestamp zero. The audio stream audio_stream_no (or the best audio
+ * stream when that one is not audio, none when negative) is reversed
+ * along with the video and muxed in the same pass.
+ *
+ * options (may be NULL):
+ *   memory_budget  bytes of decoded frames kept in memory; GOPs that do not
+ *                  fit are spilled to a memory-mapped scratch file. Of a
+ *                  budget larger than the range needs, only each worker's
+ *                  share of the range (or the longest GOP) is allocated
+ *   scratch_path   prefix of the scratch files: spilled frames (one per
+ *                  pipeline buffer, suffixed .0, .1, ...) and the workers'
+ *                  video and audio chunks (.chunkN, .pcmN); default
+ *                  <dst>.scratchN, <dst>.chunkN and <dst>.pcmN
+ *   workers        number of segment workers, each with its own decoder and
+ *                  encoder; default one per core, as many as the budget holds
+ *   video_encoder  encoder name, e.g. libx264 when it is linked in; default
+ *                  the output container's default video encoder
+ *   bitrate        video bits per second; default the source's bit rate
+ *   preset         speed preset of encoders that have one (libx264:
+ *                  ultrafast ... placebo)
+ *   threads        threads of each worker's encoder; default the encoder's
+ *   lookahead      frames of rate control lookahead (libx264 rc-lookahead)
+ *   gop            frames between keyframes; default the source's GOP
+ *                  within a segment, one keyframe per segment for sources
+ *                  made only of keyframes (every segment starts on one)
+ *   qmin, qmax     quantizer range; default the encoder's
+ *   boomerang      "1" writes the range forward and then reversed into one
+ *                  output. Every segment is decoded once and its frames are
+ *                  encoded in both directions by the same encoder, each
+ *                  direction starting on a keyframe; frame_cache is ignored
+ *   checkpoint     "1" makes the job resumable: each segment is encoded as
+ *                  a piece starting on a keyframe, the chunks are kept on
+ *                  disk and a manifest (<scratch_path or dst>.job) records
+ *                  the source's size and mtime, the arguments, the segment
+ *                  plan and every segment written. A job run again with
+ *                  the same arguments after being killed or cancelled
+ *                  skips the segments recorded and only encodes the rest;
+ *                  the files are removed once the output is complete
+ *   decoder_threads  threads of each worker's decoder; default "auto", the
+ *                  cores divided between the workers
+ *   decoder_thread_type  "auto" (default, frame and slice threading as the
+ *                  codec allows), "frame" or "slice"
+ *   direct_render  "1" (default) lets the decoders render into the memory
+ *                  the frames are stored in, so 8-bit 4:2:0 pictures at
+ *                  the output size are kept without a copy; "0" copies
+ *                  every decoded picture
+ *   stream_copy    "auto" (default) writes the packets of a stream made only
+ *                  of keyframes (MJPEG, ProRes, all-intra H.264) backwards
+ *                  without decoding, unless an encoder or bit rate is asked
+ *                  for; "1" copies whenever the container takes the codec,
+ *                  "0" always transcodes
+ *   frame_cache    "delta" keeps the decoded frames of a segment as XOR
+ *                  deltas of their successor with the unchanged runs left
+ *                  out, instead of raw pictures or the spill file; meant
+ *                  for mostly static sources such as screen recordings
+ *                  with long GOPs. Frames that do not fit are decoded
+ *                  again, so busy content is better left raw
+ *   frame_cache_ratio  frames per raw frame of memory the cache plans
+ *                  segments for (default 4)
+ *   timing         "source" (default) keeps each frame's timestamp and
+ *                  duration, mirrored, in containers that store them per
+ *                  frame (MP4, MOV, 3GP, Matroska, WebM, FLV, NUT), so
+ *                  variable frame rate sources keep their rhythm; "cfr"
+ *                  spaces the frames evenly at the output frame rate
+ *   progressive    "1" writes a fragmented MP4 (MP4, MOV and 3GP outputs)
+ *                  while the job runs instead of muxing it at the end:
+ *                  every segment becomes a fragment as soon as it and the
+ *                  ones before it in the output are encoded, and is
+ *                  reported to the fragment callback, see
+ *                  reverse_context_set_fragment_callback()
+ *   preview        longest side in pixels of a scaled down output for quick
+ *                  previews: the decoder drops resolution (lowres) where the
+ *                  codec can, frames are scaled with libyuv and stored at
+ *                  the preview size, and the default bit rate shrinks with
+ *                  the picture
+ *   index_cache    directory for sidecar files keeping the packet index of
+ *                  a source reversed whole, which later jobs on it, ranges
+ *                  included, use instead of a demux pass; an app-private
+ *                  cache directory on Android. Default none
+ *
+ * Frames are stored as 8-bit yuv420p whatever the source's format: NV12,
+ * NV21, 8-bit 4:2:2 and 4:4:4 and high bit depth 4:2:0 are converted with
+ * libyuv or a shift while they are copied in, other formats with swscale.
+ *
+ * The output frame rate is the source's, snapped to the nearest one the
+ * encoder supports; it drives the rate control and, with constant timing,
+ * the timestamps. A frame shown from t for d in a range [s, e) is shown
+ * from e - (t + d) in the output, so the range keeps its length and its
+ * audio stays in step. When copying, no frame is encoded and
+ * reverse_context_encode_fps() reports 0. With boomerang, frame counts
+ * include both directions.
+ */
 int reverse(char *file_path_src, char *file_path_desc,
   long positionUsStart, long positionUsEnd,
   int video_stream_no, int audio_stream_no,
-  int subtitle_stream_no);
+  int subtitle_stream_no, AVDictionary *options);
+
+/*
+ * The same job as a handle, so several reverses can run at once in one
+ * process, each on its own thread. create() copies the paths and options,
+ * run() does the work once and blocks until it is done, and cancel() may be
+ * called from any thread while run() is in progress: the job stops at the
+ * next frame or packet and run() returns AVERROR_EXIT. destroy() must not
+ * race with run(). create() returns NULL when out of memory.
+ */
+typedef struct ReverseContext ReverseContext;
+
+ReverseContext *reverse_context_create(const char *file_path_src,
+  const char *file_path_desc,
+  long positionUsStart, long positionUsEnd,
+  int video_stream_no, int audio_stream_no,
+  int subtitle_stream_no, AVDictionary *options);
+/*
+ * Progressive output: once a fragment is on disk, bytes [offset, offset +
+ * size) of the output file may be read, uploaded or played. The first
+ * fragment also holds the header and the last one, with last set, the
+ * trailer; endUs is the output time the fragment's frames end at.
+ */
+typedef struct ReverseFragment {
+  int index;
+  int64_t offset;
+  int64_t size;
+  int64_t endUs;
+  int last;
+} ReverseFragment;
+
+typedef void (*ReverseFragmentCallback)(void *opaque,
+                                        const ReverseFragment *fragment);
+
+/* Called for every fragment of a "progressive" job, on the thread running
+ * run(); set before run(). */
+void reverse_context_set_fragment_callback(ReverseContext *ctx,
+                                           ReverseFragmentCallback callback,
+                                           void *opaque);
+/* whether the job was asked for "progressive" output, i.e. has fragments
+ * to report */
+int reverse_context_progressive(ReverseContext *ctx);
+int reverse_context_run(ReverseContext *ctx);
+void reverse_context_cancel(ReverseContext *ctx);
+/* frames encoded per second of the last run() across all workers */
+double reverse_context_encode_fps(ReverseContext *ctx);
+
+/*
+ * Where the last run() spent its time, in microseconds. The stages run on
+ * every worker's threads at once, so they are summed over the threads and
+ * may add up to more than wallUs. demuxUs includes the indexing pass,
+ * copyUs storing frames in the pool or frame cache and restoring them,
+ * convertUs libyuv and swscale work, audioUs decoding the audio and muxUs
+ * writing the output file, audio encoding included. frames leaves out the
+ * frames a resumed job took from its checkpoint. decodedFrames counts
+ * every frame out of the decoders, so decodedFrames / frames is the decode
+ * work per output frame: 1 when each frame is decoded once, more when
+ * segments of a long GOP decode its start again, 0 for a stream copy.
+ */
+typedef struct ReverseStats {
+  int frames;
+  int decodedFrames;
+  int64_t wallUs;
+  int64_t demuxUs;
+  int64_t decodeUs;
+  int64_t copyUs;
+  int64_t convertUs;
+  int64_t encodeUs;
+  int64_t audioUs;
+  int64_t muxUs;
+} ReverseStats;
+
+void reverse_context_stats(ReverseContext *ctx, ReverseStats *stats);
+void reverse_context_destroy(ReverseContext *ctx);
 
 int demuxing(const char *src_filename, const char *video_dst_filename, const char *audio_dst_filename);
 int mux(const char *filename);
@@ -25,4 +198,6 @@ void audio_encode_example(const char *filename);
 void write_video_frame(AVFormatContext *oc, AVStream *st);
 AVStream *add_video_stream(AVFormatContext *oc, AVCodec **codec,
                            enum AVCodecID codec_id);
-void open_video(AVFormatContext *oc, AVCodec *codec, AVStream *st);
\ No newline at end of file
+void open_video(AVFormatContext *oc, AVCodec *codec, AVStream *st);
+
+#endif /* REVERSE_H_ */
@@ -0,0 +1,33 @@
+/*
+ * reverse_log.c
+ *
+ * stderr backend of reverse_log.h for host builds.
+ */
+
+#include "reverse_log.h"
+
+#ifndef __ANDROID__
+
+#include <stdarg.h>
+#include <stdio.h>
+
+static int logLevel = ANDROID_LOG_WARN;
+
+int reverse_log_print(int prio, const char *tag, const char *fmt, ...) {
+  va_list vl;
+  int ret;
+  if (prio < logLevel) {
+    return 0;
+  }
+  fprintf(stderr, "[%s] ", tag);
+  va_start(vl, fmt);
+  ret = vfprintf(stderr, fmt, vl);
+  va_end(vl);
+  return ret;
+}
+
+void reverse_log_set_level(int prio) {
+  logLevel = prio;
+}
+
+#endif /* __ANDROID__ */
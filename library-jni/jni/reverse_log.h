@@ -0,0 +1,34 @@
+/*
+ * reverse_log.h
+ *
+ * Logging of the reverse engine: logcat on Android, stderr on a host build
+ * (reverse-cli), so the engine builds off-device unchanged.
+ */
+
+#ifndef REVERSE_LOG_H_
+#define REVERSE_LOG_H_
+
+#ifdef __ANDROID__
+
+#include <android/log.h>
+
+#define reverse_log_print __android_log_print
+
+#else
+
+/* the android_LogPriority values the engine logs with */
+#define ANDROID_LOG_VERBOSE 2
+#define ANDROID_LOG_DEBUG 3
+#define ANDROID_LOG_INFO 4
+#define ANDROID_LOG_WARN 5
+#define ANDROID_LOG_ERROR 6
+
+int reverse_log_print(int prio, const char *tag, const char *fmt, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
+/* Messages below prio are dropped; ANDROID_LOG_WARN by default. */
+void reverse_log_set_level(int prio);
+
+#endif /* __ANDROID__ */
+
+#endif /* REVERSE_LOG_H_ */
@@ -0,0 +1,354 @@
+/*
+ * reverse_queue.c
+ *
+ * Batch scheduler of reverse jobs, see reverse_queue.h.
+ */
+
+#include "reverse_queue.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/avstring.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+typedef struct ReverseJob {
+  int id;
+  char *srcPath;
+  char *dstPath;
+  long positionUsStart;
+  long positionUsEnd;
+  int videoStreamNo;
+  int audioStreamNo;
+  int subtitleStreamNo;
+  AVDictionary *options;
+  /* set while it runs, for cancel() */
+  ReverseContext *ctx;
+  ReverseJobStatus status;
+  int cancelled;
+  int released;
+  /* what it holds of the pool while it runs */
+  int cores;
+  int64_t memory;
+  struct ReverseJob *next;
+} ReverseJob;
+
+struct ReverseQueue {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t *threads;
+  int threadCount;
+  int cores;
+  int freeCores;
+  int64_t memoryBudget;
+  int64_t freeMemory;
+  /* every job not released, in the order submitted */
+  ReverseJob *jobs;
+  int queuedJobs;
+  int runningJobs;
+  int nextId;
+  int stopping;
+};
+
+static void reverse_queue_free_job(ReverseJob *job) {
+  av_freep(&job->srcPath);
+  av_freep(&job->dstPath);
+  av_dict_free(&job->options);
+  av_free(job);
+}
+
+static void reverse_queue_unlink(ReverseQueue *queue, ReverseJob *job) {
+  ReverseJob **link = &queue->jobs;
+  while (*link != job) {
+    link = &(*link)->next;
+  }
+  *link = job->next;
+}
+
+static ReverseJob *reverse_queue_find(ReverseQueue *queue, int id) {
+  ReverseJob *job;
+  for (job = queue->jobs; job; job = job->next) {
+    if (job->id == id) {
+      return job;
+    }
+  }
+  return NULL;
+}
+
+static int64_t reverse_queue_option(ReverseJob *job, const char *key) {
+  AVDictionaryEntry *entry = av_dict_get(job->options, key, NULL, 0);
+  return entry ? strtoll(entry->value, NULL, 10) : 0;
+}
+
+/* The first queued job, with its share of the pool in cores and memory,
+ * when the pool has that much free. Jobs start in order, so a large one is
+ * not passed over by the small ones behind it. */
+static ReverseJob *reverse_queue_next(ReverseQueue *queue) {
+  ReverseJob *job;
+  int jobs;
+  for (job = queue->jobs; job; job = job->next) {
+    if (job->status.state == REVERSE_JOB_QUEUED) {
+      break;
+    }
+  }
+  if (!job || queue->freeCores <= 0) {
+    return NULL;
+  }
+  jobs = FFMIN(queue->runningJobs + queue->queuedJobs, queue->cores);
+  /* a worker keeps two cores busy, its decoder and its encoder */
+  job->cores = (int) FFMIN(reverse_queue_option(job, "workers") * 2, INT_MAX);
+  if (job->cores <= 0) {
+    job->cores = FFMAX(queue->cores / jobs, 1);
+  }
+  job->cores = FFMIN(job->cores, queue->freeCores);
+  job->memory = reverse_queue_option(job, "memory_budget");
+  if (job->memory <= 0) {
+    job->memory = queue->memoryBudget * job->cores / queue->cores;
+  }
+  job->memory = FFMIN(job->memory, queue->memoryBudget);
+  if (job->memory > queue->freeMemory) {
+    return NULL;
+  }
+  return job;
+}
+
+/* Hands the job its share through its options: the engine then runs a
+ * worker for every two of its cores, each decoding on one thread and
+ * encoding on another, and keeps its frames within its memory. */
+static void reverse_queue_apply_share(ReverseJob *job) {
+  char value[32];
+  snprintf(value, sizeof(value), "%d", FFMAX(job->cores / 2, 1));
+  av_dict_set(&job->options, "workers", value, 0);
+  snprintf(value, sizeof(value), "%"PRId64, job->memory);
+  av_dict_set(&job->options, "memory_budget", value, 0);
+  av_dict_set(&job->options, "decoder_threads", "1", AV_DICT_DONT_OVERWRITE);
+  av_dict_set(&job->options, "threads", "1", AV_DICT_DONT_OVERWRITE);
+}
+
+static void reverse_queue_run_job(ReverseQueue *queue, ReverseJob *job) {
+  ReverseContext *ctx;
+  int result = AVERROR(ENOMEM);
+  ReverseStats stats;
+  double encodeFps = 0;
+  memset(&stats, 0, sizeof(stats));
+  ctx = reverse_context_create(job->srcPath, job->dstPath,
+                               job->positionUsStart, job->positionUsEnd,
+                               job->videoStreamNo, job->audioStreamNo,
+                               job->subtitleStreamNo, job->options);
+  pthread_mutex_lock(&queue->mutex);
+  job->ctx = ctx;
+  if (ctx && job->cancelled) {
+    reverse_context_cancel(ctx);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  if (ctx) {
+    result = reverse_context_run(ctx);
+    reverse_context_stats(ctx, &stats);
+    encodeFps = reverse_context_encode_fps(ctx);
+    pthread_mutex_lock(&queue->mutex);
+    job->ctx = NULL;
+    pthread_mutex_unlock(&queue->mutex);
+    reverse_context_destroy(ctx);
+  }
+
+  pthread_mutex_lock(&queue->mutex);
+  job->status.result = result;
+  job->status.stats = stats;
+  job->status.encodeFps = encodeFps;
+  job->status.state = REVERSE_JOB_DONE;
+  queue->freeCores += job->cores;
+  queue->freeMemory += job->memory;
+  queue->runningJobs--;
+  if (job->released) {
+    reverse_queue_unlink(queue, job);
+    reverse_queue_free_job(job);
+  }
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+static void *reverse_queue_thread(void *data) {
+  ReverseQueue *queue = (ReverseQueue *) data;
+  ReverseJob *job;
+  pthread_mutex_lock(&queue->mutex);
+  while (!queue->stopping) {
+    if (!(job = reverse_queue_next(queue))) {
+      pthread_cond_wait(&queue->cond, &queue->mutex);
+      continue;
+    }
+    job->status.state = REVERSE_JOB_RUNNING;
+    queue->queuedJobs--;
+    queue->runningJobs++;
+    queue->freeCores -= job->cores;
+    queue->freeMemory -= job->memory;
+    reverse_queue_apply_share(job);
+    LOGI(LOG_LEVEL, "reverse_queue: job %d starts on %d cores with %"PRId64
+         " bytes, %d jobs waiting\n", job->id, job->cores, job->memory,
+         queue->queuedJobs);
+    pthread_mutex_unlock(&queue->mutex);
+    reverse_queue_run_job(queue, job);
+    pthread_mutex_lock(&queue->mutex);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return NULL;
+}
+
+ReverseQueue *reverse_queue_create(int threads, int64_t memoryBudget) {
+  ReverseQueue *queue = av_mallocz(sizeof(ReverseQueue));
+  if (!queue) {
+    return NULL;
+  }
+  if (threads <= 0) {
+    threads = (int) FFMAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+  }
+  if (memoryBudget <= 0) {
+    memoryBudget = (int64_t) sysconf(_SC_PHYS_PAGES) *
+                   sysconf(_SC_PAGESIZE) / 4;
+  }
+  queue->cores = queue->freeCores = threads;
+  queue->memoryBudget = queue->freeMemory = memoryBudget;
+  queue->nextId = 1;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->cond, NULL);
+  /* every job has at least a core, so no more can run at once */
+  queue->threads = av_malloc(threads * sizeof(pthread_t));
+  if (!queue->threads) {
+    reverse_queue_destroy(queue);
+    return NULL;
+  }
+  for (; queue->threadCount < threads; queue->threadCount++) {
+    if (pthread_create(&queue->threads[queue->threadCount], NULL,
+                       reverse_queue_thread, queue) != 0) {
+      break;
+    }
+  }
+  if (queue->threadCount == 0) {
+    reverse_queue_destroy(queue);
+    return NULL;
+  }
+  return queue;
+}
+
+int reverse_queue_submit(ReverseQueue *queue, const char *file_path_src,
+                         const char *file_path_desc,
+                         long positionUsStart, long positionUsEnd,
+                         int video_stream_no, int audio_stream_no,
+                         int subtitle_stream_no, AVDictionary *options) {
+  ReverseJob *job = av_mallocz(sizeof(ReverseJob));
+  ReverseJob **link;
+  int id;
+  if (!job) {
+    return AVERROR(ENOMEM);
+  }
+  job->srcPath = av_strdup(file_path_src);
+  job->dstPath = av_strdup(file_path_desc);
+  if (!job->srcPath || !job->dstPath) {
+    reverse_queue_free_job(job);
+    return AVERROR(ENOMEM);
+  }
+  av_dict_copy(&job->options, options, 0);
+  job->positionUsStart = positionUsStart;
+  job->positionUsEnd = positionUsEnd;
+  job->videoStreamNo = video_stream_no;
+  job->audioStreamNo = audio_stream_no;
+  job->subtitleStreamNo = subtitle_stream_no;
+  job->status.state = REVERSE_JOB_QUEUED;
+
+  pthread_mutex_lock(&queue->mutex);
+  id = job->id = queue->nextId++;
+  for (link = &queue->jobs; *link; link = &(*link)->next) {
+  }
+  *link = job;
+  queue->queuedJobs++;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  return id;
+}
+
+int reverse_queue_poll(ReverseQueue *queue, int id, ReverseJobStatus *status) {
+  ReverseJob *job;
+  int err = AVERROR(ENOENT);
+  pthread_mutex_lock(&queue->mutex);
+  if ((job = reverse_queue_find(queue, id)) && !job->released) {
+    *status = job->status;
+    err = 0;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return err;
+}
+
+/* with the queue locked */
+static void reverse_queue_cancel_job(ReverseQueue *queue, ReverseJob *job) {
+  job->cancelled = 1;
+  if (job->status.state == REVERSE_JOB_QUEUED) {
+    job->status.state = REVERSE_JOB_DONE;
+    job->status.result = AVERROR_EXIT;
+    queue->queuedJobs--;
+    /* the jobs behind may fit now */
+    pthread_cond_broadcast(&queue->cond);
+  } else if (job->ctx) {
+    reverse_context_cancel(job->ctx);
+  }
+}
+
+int reverse_queue_cancel(ReverseQueue *queue, int id) {
+  ReverseJob *job;
+  int err = AVERROR(ENOENT);
+  pthread_mutex_lock(&queue->mutex);
+  if ((job = reverse_queue_find(queue, id)) && !job->released) {
+    reverse_queue_cancel_job(queue, job);
+    err = 0;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return err;
+}
+
+void reverse_queue_release(ReverseQueue *queue, int id) {
+  ReverseJob *job;
+  pthread_mutex_lock(&queue->mutex);
+  if ((job = reverse_queue_find(queue, id)) && !job->released) {
+    if (job->status.state == REVERSE_JOB_QUEUED) {
+      reverse_queue_cancel_job(queue, job);
+    }
+    if (job->status.state == REVERSE_JOB_DONE) {
+      reverse_queue_unlink(queue, job);
+      reverse_queue_free_job(job);
+    } else {
+      /* the thread running it frees it */
+      job->released = 1;
+    }
+  }
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+void reverse_queue_destroy(ReverseQueue *queue) {
+  ReverseJob *job;
+  int i;
+  if (!queue) {
+    return;
+  }
+  pthread_mutex_lock(&queue->mutex);
+  queue->stopping = 1;
+  for (job = queue->jobs; job; job = job->next) {
+    reverse_queue_cancel_job(queue, job);
+  }
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  for (i = 0; i < queue->threadCount; i++) {
+    pthread_join(queue->threads[i], NULL);
+  }
+  while ((job = queue->jobs)) {
+    queue->jobs = job->next;
+    reverse_queue_free_job(job);
+  }
+  pthread_cond_destroy(&queue->cond);
+  pthread_mutex_destroy(&queue->mutex);
+  av_freep(&queue->threads);
+  av_free(queue);
+}
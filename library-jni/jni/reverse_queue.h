@@ -0,0 +1,72 @@
+/*
+ * reverse_queue.h
+ *
+ * Batches of reverse jobs (see reverse.h) run by one pool of threads, no
+ * more than there are cores. Jobs start in the order they were submitted;
+ * each one is given a share of the cores and the same share of one memory
+ * budget, which becomes its "memory_budget". A worker runs a decoder
+ * thread and an encoder thread, so a job gets a worker for every two of
+ * its cores (its "workers", at least one). A job waits until both are
+ * free, so a batch keeps the cores busy without running more busy threads
+ * than cores (a one core share still runs its worker's two) or holding
+ * more decoded frames than the budget. The share is fixed when a job
+ * starts: the cores divided by the jobs running and waiting then.
+ *
+ * That split is all the jobs share: each one still opens its own
+ * demuxers, decoders, encoders and frame pools, exactly as a job run on
+ * its own would, so nothing decoded by one job is reused by another.
+ */
+
+#ifndef REVERSE_QUEUE_H_
+#define REVERSE_QUEUE_H_
+
+#include "reverse.h"
+
+typedef struct ReverseQueue ReverseQueue;
+
+typedef enum ReverseJobState {
+  REVERSE_JOB_QUEUED = 0,
+  REVERSE_JOB_RUNNING,
+  REVERSE_JOB_DONE
+} ReverseJobState;
+
+typedef struct ReverseJobStatus {
+  ReverseJobState state;
+  /* once done: what reverse_context_run() returned, AVERROR_EXIT for a
+   * job cancelled before or while it ran */
+  int result;
+  double encodeFps;
+  ReverseStats stats;
+} ReverseJobStatus;
+
+/* threads is the number of cores shared by the jobs, 0 for all of them;
+ * memoryBudget the bytes of decoded frames they share, 0 for a quarter of
+ * the physical memory. Returns NULL when out of memory. */
+ReverseQueue *reverse_queue_create(int threads, int64_t memoryBudget);
+
+/* Queues a job with the arguments of reverse_context_create(). Options the
+ * caller sets are kept: "workers" then takes two cores of the pool each,
+ * "memory_budget" that much of its budget, and "decoder_threads" and
+ * "threads" (1 by default in a queue) are left as they are. Returns the
+ * job's id, a positive number, or a negative AVERROR. */
+int reverse_queue_submit(ReverseQueue *queue, const char *file_path_src,
+                         const char *file_path_desc,
+                         long positionUsStart, long positionUsEnd,
+                         int video_stream_no, int audio_stream_no,
+                         int subtitle_stream_no, AVDictionary *options);
+
+/* Fills status; AVERROR(ENOENT) when there is no such job. */
+int reverse_queue_poll(ReverseQueue *queue, int job, ReverseJobStatus *status);
+
+/* A queued job is done at once, a running one stops at the next frame or
+ * packet. Returns AVERROR(ENOENT) when there is no such job. */
+int reverse_queue_cancel(ReverseQueue *queue, int job);
+
+/* Forgets a job: a queued one is dropped, a running one is forgotten once
+ * it is done. Jobs are kept for poll() until released. */
+void reverse_queue_release(ReverseQueue *queue, int job);
+
+/* Cancels every job and waits for the running ones to stop. */
+void reverse_queue_destroy(ReverseQueue *queue);
+
+#endif /* REVERSE_QUEUE_H_ */
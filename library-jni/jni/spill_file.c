@@ -0,0 +1,72 @@
+/*
+ * spill_file.c
+ *
+ * Memory-mapped scratch records for oversized reverse segments.
+ */
+
+#include "spill_file.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+size_t spill_file_frame_size(size_t size) {
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+int spill_file_open(SpillFile *spill, const char *path, size_t frameSize,
+                    int windowFrames) {
+  memset(spill, 0, sizeof(*spill));
+  spill->window = -1;
+  spill->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (spill->fd < 0) {
+    return -1;
+  }
+  unlink(path);
+  spill->frameSize = spill_file_frame_size(frameSize);
+  spill->windowFrames = windowFrames > 0 ? windowFrames : 1;
+  return 0;
+}
+
+static void spill_file_unmap(SpillFile *spill) {
+  if (spill->windowData) {
+    munmap(spill->windowData, spill->frameSize * spill->windowFrames);
+    spill->windowData = NULL;
+  }
+  spill->window = -1;
+}
+
+void spill_file_close(SpillFile *spill) {
+  spill_file_unmap(spill);
+  if (spill->fd >= 0) {
+    close(spill->fd);
+    spill->fd = -1;
+  }
+}
+
+uint8_t *spill_file_frame(SpillFile *spill, int n) {
+  int window = n / spill->windowFrames;
+  size_t windowSize = spill->frameSize * spill->windowFrames;
+  if (window != spill->window) {
+    off_t offset = (off_t) window * windowSize;
+    void *data;
+    spill_file_unmap(spill);
+    if (offset + (off_t) windowSize > spill->fileSize) {
+      if (ftruncate(spill->fd, offset + windowSize) < 0) {
+        return NULL;
+      }
+      spill->fileSize = offset + windowSize;
+    }
+    data = mmap(NULL, windowSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                spill->fd, offset);
+    if (data == MAP_FAILED) {
+      return NULL;
+    }
+    spill->windowData = data;
+    spill->window = window;
+  }
+  return spill->windowData +
+         spill->frameSize * (n - window * spill->windowFrames);
+}
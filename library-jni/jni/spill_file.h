@@ -0,0 +1,39 @@
+/*
+ * spill_file.h
+ *
+ * Scratch file for decoded pictures that do not fit the in-memory frame
+ * pool. Frames are fixed-size records accessed through a small mapped
+ * window, so only the window counts against resident memory and the rest
+ * is left to the page cache.
+ */
+
+#ifndef SPILL_FILE_H_
+#define SPILL_FILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct SpillFile {
+  int fd;
+  /* record size, a multiple of the page size */
+  size_t frameSize;
+  int windowFrames;
+  int window;
+  uint8_t *windowData;
+  off_t fileSize;
+} SpillFile;
+
+/* The file is unlinked right after it is created, it disappears with the
+ * descriptor even if the job dies. */
+int spill_file_open(SpillFile *spill, const char *path, size_t frameSize,
+                    int windowFrames);
+void spill_file_close(SpillFile *spill);
+
+/* Maps the window holding record n (growing the file when needed) and
+ * returns its address; valid until the next call. */
+uint8_t *spill_file_frame(SpillFile *spill, int n);
+
+size_t spill_file_frame_size(size_t size);
+
+#endif /* SPILL_FILE_H_ */
@@ -19,6 +19,7 @@
 package com.appunite.ffmpeg;
 
 import java.io.File;
+import java.util.HashMap;
 import java.util.Map;
 
 import android.app.Activity;
@@ -186,11 +187,21 @@ public class FFmpegPlayer {
 		AsyncTask<Object, Void, Integer> {
 
 		private final FFmpegPlayer player;
+		private long handle = 0;
+		private boolean cancelRequested = false;
 
 		public ReverseTask(FFmpegPlayer player) {
 			this.player = player;
 		}
 
+		public synchronized void cancelReverse() {
+			if (handle != 0) {
+				player.reverseCancelNative(handle);
+			} else {
+				cancelRequested = true;
+			}
+		}
+
 		@Override
 		protected Integer doInBackground(Object... params) {
 			String file_src = (String) params[0];
@@ -207,10 +218,28 @@ public class FFmpegPlayer {
 			int audioStreamNo = audioStream == null ? -1 : audioStream.intValue();
 			int subtitleStreamNo = subtitleStream == null ? -1 : subtitleStream.intValue();
 
-			int result = player.reverseNative(file_src, file_dest, startTime, endTime,
-				videoStreamNo, audioStreamNo, subtitleStreamNo);
-
-			return result;
+			@SuppressWarnings("unchecked")
+			Map<String, String> options = (Map<String, String>) params[7];
+
+			long job = player.reverseCreateNative(file_src, file_dest,
+				startTime, endTime, videoStreamNo, audioStreamNo, subtitleStreamNo,
+				options);
+			synchronized (this) {
+				handle = job;
+				if (cancelRequested) {
+					player.reverseCancelNative(job);
+				}
+			}
+			try {
+				int result = player.reverseRunNative(job);
+				player.mReverseEncodeFps = player.reverseEncodeFpsNative(job);
+				return result;
+			} finally {
+				synchronized (this) {
+					player.reverseDestroyNative(job);
+					handle = 0;
+				}
+			}
 		}
 
 		@Override
@@ -231,7 +260,44 @@ public class FFmpegPlayer {
 
 	public static final int UNKNOWN_STREAM = -1;
 	public static final int NO_STREAM = -2;
+
+	/**
+	 * States of a job submitted with {@link #submitReverse}
+	 */
+	public static final int REVERSE_JOB_UNKNOWN = -1;
+	public static final int REVERSE_JOB_QUEUED = 0;
+	public static final int REVERSE_JOB_RUNNING = 1;
+	public static final int REVERSE_JOB_DONE = 2;
+
+	/**
+	 * Fragments of a progressive reverse, see {@link #reverseProgressive}
+	 */
+	public interface ReverseFragmentListener {
+		/**
+		 * Called on the reverse's background thread once the fragment is
+		 * written
+		 * 
+		 * @param index
+		 *            - number of the fragment, from 0
+		 * @param offset
+		 *            - where the fragment starts in the output file
+		 * @param size
+		 *            - bytes of the fragment; the first one holds the
+		 *            header, the last one the index at the end of the file
+		 * @param endUs
+		 *            - output time the fragment's frames end at
+		 * @param isLast
+		 *            - the output file is complete
+		 */
+		void onReverseFragment(int index, long offset, long size, long endUs,
+				boolean isLast);
+	}
+
+	/* one queue for the process, so all batches share its cores and memory */
+	private static long sReverseQueue = 0;
 	private FFmpegListener mpegListener = null;
+	private volatile ReverseFragmentListener mReverseFragmentListener = null;
+	private File mReverseIndexCacheDir = null;
 	private final RenderedFrame mRenderedFrame = new RenderedFrame();
 
 	private int mNativePlayer;
@@ -254,6 +320,8 @@ public class FFmpegPlayer {
 	private long mVideoDurationUs;
 	private FFmpegStreamInfo[] mStreamsInfos = null;
 	private boolean mIsFinished = false;
+	private ReverseTask mReverseTask = null;
+	private volatile double mReverseEncodeFps = 0;
 
 	static class RenderedFrame {
 		public Bitmap bitmap;
@@ -263,6 +331,8 @@ public class FFmpegPlayer {
 
 	public FFmpegPlayer(FFmpegDisplay videoView, Activity activity) {
 		this.activity = activity;
+		this.mReverseIndexCacheDir = new File(activity.getCacheDir(),
+				"reverse-index");
 		int error = initNative();
 		if (error != 0)
 			throw new RuntimeException(String.format(
@@ -299,7 +369,43 @@ public class FFmpegPlayer {
 	public native int reverseNative(String file_src, String file_dest,
 																	long positionUsStart, long positionUsEnd,
 																	int videoStreamNo,
-																	int audioStreamNo, int subtitleStreamNo);
+																	int audioStreamNo, int subtitleStreamNo,
+																	Map<String, String> options);
+
+	/**
+	 * Reverse jobs as native handles: several of them may run at once, each
+	 * on its own thread; see reverse.h
+	 */
+	private native long reverseCreateNative(String file_src, String file_dest,
+			long positionUsStart, long positionUsEnd, int videoStreamNo,
+			int audioStreamNo, int subtitleStreamNo, Map<String, String> options);
+
+	private native int reverseRunNative(long handle);
+
+	private native double reverseEncodeFpsNative(long handle);
+
+	private native void reverseCancelNative(long handle);
+
+	private native void reverseDestroyNative(long handle);
+
+	/**
+	 * Batches of reverse jobs on a native pool of threads sharing the cores
+	 * and one memory budget; see reverse_queue.h
+	 */
+	private native long reverseQueueCreateNative(int threads, long memoryBudget);
+
+	private native int reverseQueueSubmitNative(long queue, String file_src,
+			String file_dest, long positionUsStart, long positionUsEnd,
+			int videoStreamNo, int audioStreamNo, int subtitleStreamNo,
+			Map<String, String> options);
+
+	private native int reverseQueuePollNative(long queue, int job);
+
+	private native int reverseQueueResultNative(long queue, int job);
+
+	private native void reverseQueueCancelNative(long queue, int job);
+
+	private native void reverseQueueReleaseNative(long queue, int job);
 
 	/**
 	 * 
@@ -349,11 +455,201 @@ public class FFmpegPlayer {
 	}
 
 	public void reverse() {
+		reverse(null);
+	}
+
+	/**
+	 * 
+	 * @param options
+	 *            - reverse options passed to the native engine, e.g.
+	 *            "memory_budget" (bytes), could be null
+	 */
+	public void reverse(Map<String, String> options) {
+		reverse(0, 0, options);
+	}
+
+	/**
+	 * 
+	 * @param positionUsStart
+	 *            - start of the reversed range in microseconds, 0 for the
+	 *            beginning of the file
+	 * @param positionUsEnd
+	 *            - end of the reversed range in microseconds (exclusive), 0
+	 *            for the end of the file
+	 * @param options
+	 *            - reverse options passed to the native engine, could be null
+	 */
+	public void reverse(long positionUsStart, long positionUsEnd,
+			Map<String, String> options) {
 		String file_dest = getSDCardFile("filereverse.mp4");
-		new ReverseTask(this).execute(javaFilePath2c(this.file_src),
+		if (mReverseIndexCacheDir != null
+				&& (options == null || !options.containsKey("index_cache"))
+				&& (mReverseIndexCacheDir.isDirectory() || mReverseIndexCacheDir
+						.mkdirs())) {
+			options = options == null ? new HashMap<String, String>()
+					: new HashMap<String, String>(options);
+			options.put("index_cache", mReverseIndexCacheDir.getAbsolutePath());
+		}
+		mReverseTask = new ReverseTask(this);
+		mReverseTask.executeOnExecutor(AsyncTask.THREAD_POOL_EXECUTOR,
+			javaFilePath2c(this.file_src),
 			javaFilePath2c(file_dest),
-			Long.valueOf(0), Long.valueOf(0),
-			Integer.valueOf(1), Integer.valueOf(0), Integer.valueOf(0));
+			Long.valueOf(positionUsStart), Long.valueOf(positionUsEnd),
+			Integer.valueOf(1), Integer.valueOf(0), Integer.valueOf(0),
+			options);
+	}
+
+	/**
+	 * Reverses the whole file scaled down for a quick preview
+	 * 
+	 * @param previewSize
+	 *            - longest side of the preview in pixels
+	 */
+	public void reversePreview(int previewSize) {
+		Map<String, String> options = new HashMap<String, String>();
+		options.put("preview", Integer.toString(previewSize));
+		reverse(options);
+	}
+
+	/**
+	 * Exports the range forward and then reversed into one file, decoding
+	 * it once
+	 * 
+	 * @param positionUsStart
+	 *            - start of the range in microseconds
+	 * @param positionUsEnd
+	 *            - end of the range in microseconds
+	 */
+	public void reverseBoomerang(long positionUsStart, long positionUsEnd) {
+		Map<String, String> options = new HashMap<String, String>();
+		options.put("boomerang", "1");
+		reverse(positionUsStart, positionUsEnd, options);
+	}
+
+	/**
+	 * Reverses the range with checkpoints: when the process is killed (or
+	 * the reverse cancelled), starting it again with the same range goes
+	 * on from the last segment finished instead of from the start
+	 * 
+	 * @param positionUsStart
+	 *            - start of the reversed range in microseconds, 0 for the
+	 *            beginning of the file
+	 * @param positionUsEnd
+	 *            - end of the reversed range in microseconds (exclusive), 0
+	 *            for the end of the file
+	 */
+	public void reverseResumable(long positionUsStart, long positionUsEnd) {
+		Map<String, String> options = new HashMap<String, String>();
+		options.put("checkpoint", "1");
+		reverse(positionUsStart, positionUsEnd, options);
+	}
+
+	/**
+	 * Reverses the range into a fragmented MP4 written while the job runs:
+	 * every fragment reported to the {@link ReverseFragmentListener} may be
+	 * played or uploaded before the job is done
+	 * 
+	 * @param positionUsStart
+	 *            - start of the reversed range in microseconds, 0 for the
+	 *            beginning of the file
+	 * @param positionUsEnd
+	 *            - end of the reversed range in microseconds (exclusive), 0
+	 *            for the end of the file
+	 */
+	public void reverseProgressive(long positionUsStart, long positionUsEnd) {
+		Map<String, String> options = new HashMap<String, String>();
+		options.put("progressive", "1");
+		reverse(positionUsStart, positionUsEnd, options);
+	}
+
+	/**
+	 * Stops the last reverse started by this player; its output is left
+	 * incomplete
+	 */
+	public void cancelReverse() {
+		if (mReverseTask != null) {
+			mReverseTask.cancelReverse();
+		}
+	}
+
+	private long reverseQueue() {
+		synchronized (FFmpegPlayer.class) {
+			if (sReverseQueue == 0) {
+				sReverseQueue = reverseQueueCreateNative(0, 0);
+			}
+			return sReverseQueue;
+		}
+	}
+
+	/**
+	 * Queues a reverse of fileSrc into fileDest. Queued jobs run in the
+	 * order submitted, as many at once as the cores allow, within a
+	 * quarter of the device memory for all of them
+	 * 
+	 * @param fileSrc
+	 *            - path of the source
+	 * @param fileDest
+	 *            - path of the output
+	 * @param positionUsStart
+	 *            - start of the reversed range in microseconds, 0 for the
+	 *            beginning of the file
+	 * @param positionUsEnd
+	 *            - end of the reversed range in microseconds (exclusive), 0
+	 *            for the end of the file
+	 * @param options
+	 *            - reverse options passed to the native engine, could be null
+	 * @return id of the job, negative when it could not be queued
+	 */
+	public int submitReverse(String fileSrc, String fileDest,
+			long positionUsStart, long positionUsEnd,
+			Map<String, String> options) {
+		return reverseQueueSubmitNative(reverseQueue(), fileSrc, fileDest,
+			positionUsStart, positionUsEnd, 1, 0, 0, options);
+	}
+
+	/**
+	 * 
+	 * @param job
+	 *            - id from {@link #submitReverse}
+	 * @return REVERSE_JOB_QUEUED, REVERSE_JOB_RUNNING, REVERSE_JOB_DONE or
+	 *         REVERSE_JOB_UNKNOWN for a job released or never submitted
+	 */
+	public int pollReverse(int job) {
+		return reverseQueuePollNative(reverseQueue(), job);
+	}
+
+	/**
+	 * 
+	 * @param job
+	 *            - id of a job polled REVERSE_JOB_DONE
+	 * @return 0 when the output was written, a negative error otherwise
+	 */
+	public int getReverseResult(int job) {
+		return reverseQueueResultNative(reverseQueue(), job);
+	}
+
+	/**
+	 * Drops a queued job or stops a running one; it is then done with an
+	 * error
+	 */
+	public void cancelReverse(int job) {
+		reverseQueueCancelNative(reverseQueue(), job);
+	}
+
+	/**
+	 * Forgets a job once its result is no longer needed; a queued one is
+	 * dropped, a running one keeps running
+	 */
+	public void releaseReverse(int job) {
+		reverseQueueReleaseNative(reverseQueue(), job);
+	}
+
+	/**
+	 * 
+	 * @return frames per second the last finished reverse encoded
+	 */
+	public double getReverseEncodeFps() {
+		return mReverseEncodeFps;
 	}
 
 	private Bitmap prepareFrame(int width, int height) {
@@ -366,6 +662,14 @@ public class FFmpegPlayer {
 		return bitmap;
 	}
 
+	private void onReverseFragment(int index, long offset, long size,
+			long endUs, boolean isLast) {
+		ReverseFragmentListener listener = mReverseFragmentListener;
+		if (listener != null) {
+			listener.onReverseFragment(index, offset, size, endUs, isLast);
+		}
+	}
+
 	private void onUpdateTime(long currentUs, long maxUs, boolean isFinished) {
 
 		this.mCurrentTimeUs = currentUs;
@@ -427,6 +731,16 @@ public class FFmpegPlayer {
 		setDataSource(url, null, UNKNOWN_STREAM, UNKNOWN_STREAM, NO_STREAM);
 	}
 
+	/**
+	 * Opens a data source
+	 * 
+	 * @param dictionary
+	 *            - demuxer and protocol options, could be null; also
+	 *            "decoder_threads" (a count or "auto", the default) and
+	 *            "decoder_thread_type" ("auto", "frame", "slice" or
+	 *            "low_delay", which avoids the frame delay of frame
+	 *            threading)
+	 */
 	public void setDataSource(String url, Map<String, String> dictionary,
 			int videoStream, int audioStream, int subtitlesStream) {
 		this.file_src = url;
@@ -442,5 +756,21 @@ public class FFmpegPlayer {
 	public void setMpegListener(FFmpegListener mpegListener) {
 		this.mpegListener = mpegListener;
 	}
+
+	public void setReverseFragmentListener(ReverseFragmentListener listener) {
+		this.mReverseFragmentListener = listener;
+	}
+
+	/**
+	 * Keeps the packet index of every file reversed whole in dir, so later
+	 * reverses of the same file, ranges included, skip indexing it
+	 * 
+	 * @param dir
+	 *            - an app-private directory, by default reverse-index in
+	 *            the activity's cache directory; null for no index cache
+	 */
+	public void setReverseIndexCacheDir(File dir) {
+		this.mReverseIndexCacheDir = dir;
+	}
 	
 }